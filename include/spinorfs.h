@@ -30,6 +30,47 @@ enum spinofs_open_flags {
     SPINORFS_O_APPEND = 0x0800,    // Move to end of file on every write
 };
 
+// Statistics of the flash accesses
+struct spinorfs_stats {
+    uint64_t cache_hits;           // Reads served by the block cache
+    uint64_t cache_misses;         // Reads that filled an erase block
+    uint64_t erases;               // Erase blocks erased
+    uint64_t erases_skipped;       // Erases skipped, the block was blank
+    uint64_t erase_ioctls;         // MEMERASE requests sent to the driver
+    uint64_t erase_time_us;        // Time spent erasing in microseconds
+    uint64_t pages_programmed;     // Program pages written to the flash
+    uint64_t pages_skipped;        // Program pages already holding the data
+};
+
+// CRCs of the verified GPT, a cheap fingerprint of the partition table
+struct spinorfs_gpt_crc {
+    uint32_t header_crc32;         // CRC32 of the GPT header
+    uint32_t partition_array_crc32;// CRC32 of the partition entry array
+    uint64_t header_lba;           // LBA of the header, 1 unless backup used
+};
+
+// State of an MTD device and of the partition mounted on it. The functions
+// without a context argument use one process-wide context.
+typedef struct spinorfs_ctx spinorfs_ctx_t;
+
+// File open on a mounted partition. A context and its files are used by one
+// thread at a time.
+typedef struct spinorfs_file spinorfs_file_t;
+
+// littlefs settings of spinorfs_mount_with_opts, 0 keeps the size derived
+// from the MTD device
+struct spinorfs_mount_opts {
+    uint32_t read_size;            // Minimum size of a read
+    uint32_t prog_size;            // Minimum size of a program
+    uint32_t cache_size;           // Size of the read and program caches,
+                                   // also the largest inline file: the
+                                   // host firmware reads up to 512 bytes
+    uint32_t lookahead_size;       // Size of the allocator lookahead buffer
+    uint32_t read_only;            // 1 to mount without write access: the
+                                   // partition is never formatted and files
+                                   // can only be opened for reading
+};
+
 /**
  * @fn spinorfs_mount
  *
@@ -42,6 +83,22 @@ enum spinofs_open_flags {
  **/
 extern int spinorfs_mount(int mtd_fd, uint32_t size, uint32_t offset);
 
+/**
+ * @fn spinorfs_mount_with_opts
+ *
+ * @brief Mount a partition as LittleFS filesystem. The littlefs sizes are
+ *        derived from the MTD device unless set in opts.
+ * @param  mtd_fd [IN] - MTD device file descriptor info
+ * @param  size [IN]   - Size of the partition
+ * @param  offset [IN] - The location of partition in the flash
+ * @param  opts [IN]   - Mount options, NULL for the derived sizes
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_mount_with_opts(int mtd_fd, uint32_t size,
+                                    uint32_t offset,
+                                    const struct spinorfs_mount_opts *opts);
+
 /**
  * @fn spinorfs_unmount
  *
@@ -51,50 +108,138 @@ extern int spinorfs_mount(int mtd_fd, uint32_t size, uint32_t offset);
  **/
 extern int spinorfs_unmount(void);
 
+/**
+ * @fn spinorfs_set_cache_size
+ *
+ * @brief Set the number of erase blocks cached for reads. It applies from
+ *        the next mount.
+ * @param  blocks [IN] - Number of erase blocks, 0 disables the cache
+ **/
+extern void spinorfs_set_cache_size(uint32_t blocks);
+
+/**
+ * @fn spinorfs_set_blank_check
+ *
+ * @brief Enable or disable skipping the erase of blocks already blank
+ * @param  enable [IN] - 1 to read the block before erasing it, 0 to always
+ *                       erase
+ **/
+extern void spinorfs_set_blank_check(int enable);
+
+/**
+ * @fn spinorfs_set_compare_write
+ *
+ * @brief Enable or disable skipping the program of pages already holding
+ *        the data
+ * @param  enable [IN] - 1 to compare with the flash before programming,
+ *                       0 to always program
+ **/
+extern void spinorfs_set_compare_write(int enable);
+
+/**
+ * @fn spinorfs_get_stats
+ *
+ * @brief Get the statistics of the flash accesses since the last reset
+ * @param  stats [OUT] - Statistics
+ **/
+extern void spinorfs_get_stats(struct spinorfs_stats *stats);
+
+/**
+ * @fn spinorfs_reset_stats
+ *
+ * @brief Reset the statistics of the flash accesses
+ **/
+extern void spinorfs_reset_stats(void);
+
 /**
  * @fn spinorfs_open
  *
  * @brief Open file with specified mode.
  * @param  file [IN] - File to be opened
  * @param  flags [IN] - Access mode to file
+ * @return  The file handle, or NULL on failure
+ **/
+extern spinorfs_file_t *spinorfs_open(char *file, int flags);
+
+/**
+ * @fn spinorfs_close
+ *
+ * @brief Close the opened file and release its handle.
+ * Call this when finish operating on the opened file by spinorfs_open.
+ * @param  fp [IN] - File handle
  * @return  0 - Success
  *          1 - Failure
  **/
-extern int spinorfs_open(char *file, int flags);
+extern int spinorfs_close(spinorfs_file_t *fp);
 
 /**
- * @fn spinorfs_open
+ * @fn spinorfs_seek
  *
- * @brief Close the opened file.
- * Call this when finish operating on the opened file by spinorfs_open.
+ * @brief Move the position of the file. littlefs is not called when the
+ *        file is already at offset.
+ * @param  fp [IN/OUT] - File handle
+ * @param  offset [IN] - File offset
  * @return  0 - Success
  *          1 - Failure
  **/
-extern int spinorfs_close();
+extern int spinorfs_seek(spinorfs_file_t *fp, uint32_t offset);
+
+/**
+ * @fn spinorfs_size
+ *
+ * @brief Get the size of the file.
+ * @param  fp [IN] - File handle
+ * @return  The size of the file in byte, or -1 on failure
+ **/
+extern int spinorfs_size(spinorfs_file_t *fp);
 
 /**
  * @fn spinorfs_read
  *
  * @brief Read size bytes of file into buffer. File should be opened
  *        before reading.
+ * @param  fp [IN/OUT] - File handle
  * @param  buff [IN] - Target buffer stores the read file data
  * @param  offset [IN] - File offset
  * @param  size [IN] - Content size
  * @return  The number of bytes read, or -1 on failure
  **/
-extern int spinorfs_read(char *buff, uint32_t offset, uint32_t size);
+extern int spinorfs_read(spinorfs_file_t *fp, char *buff, uint32_t offset,
+                         uint32_t size);
 
 /**
  * @fn spinorfs_write
  *
  * @brief Write data buffer into file.
- * @param  file [IN] - file to be written to
+ * @param  fp [IN/OUT] - File handle
  * @param  buff [IN] - Target buffer stores the write file data
  * @param  offset [IN] - File offset
  * @param  size [IN] - Content size
  * @return  The number of bytes written, or -1 on failure
  **/
-extern int spinorfs_write(char *buff, uint32_t offset, uint32_t size);
+extern int spinorfs_write(spinorfs_file_t *fp, char *buff, uint32_t offset,
+                          uint32_t size);
+
+/**
+ * @fn spinorfs_rename
+ *
+ * @brief Rename a file, atomically replacing the new file if it exists.
+ * @param  old_file [IN] - File to be renamed
+ * @param  new_file [IN] - New name of the file
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_rename(char *old_file, char *new_file);
+
+/**
+ * @fn spinorfs_remove
+ *
+ * @brief Remove a file.
+ * @param  file [IN] - File to be removed
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_remove(char *file);
 
 /**
  * @fn spinorfs_gpt_disk_info
@@ -132,4 +277,279 @@ extern int spinorfs_gpt_part_guid_info(uint8_t *guid,
  **/
 extern int spinorfs_gpt_part_name_info(char *part,
                                   uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_gpt_find_guid
+ *
+ * @brief Get offset and size of the partition via GUID. With the GPT
+ *        cache enabled (the default) the cached partition table is used, or
+ *        built from the whole GPT when the cache is stale. Otherwise the GPT
+ *        is read only up to the matching entry and no table is built.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_gpt_find_guid(int dev_fd, uint8_t *guid,
+                                  uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_gpt_find_name
+ *
+ * @brief Get offset and size of the partition via partition name. With the GPT
+ *        cache enabled (the default) the cached partition table is used, or
+ *        built from the whole GPT when the cache is stale. Otherwise the GPT
+ *        is read only up to the matching entry and no table is built.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_gpt_find_name(int dev_fd, char *part,
+                                  uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_gpt_set_cache_dir
+ *
+ * @brief Set the directory of the GPT cache files
+ * @param  dir [IN] - Directory, NULL disables the cache
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_gpt_set_cache_dir(const char *dir);
+
+/**
+ * @fn spinorfs_gpt_get_crc
+ *
+ * @brief Get the CRCs of the last GPT header and partition entry array
+ *        verified by spinorfs_gpt_disk_info or spinorfs_gpt_find_*
+ * @param  crc [OUT] - CRCs and LBA of the verified GPT header
+ * @return  0 - Success
+ *          1 - Failure, no GPT verified yet
+ **/
+extern int spinorfs_gpt_get_crc(struct spinorfs_gpt_crc *crc);
+
+/**
+ * @fn spinorfs_ctx_create
+ *
+ * @brief Create a context owning the state of an MTD device: its geometry,
+ *        partition table, mounted partition, buffers, cache and open file.
+ *        Contexts are independent, each one can be used from its own thread.
+ * @param  mtd_fd [IN] - MTD device file descriptor info, closed by the caller
+ *                       after spinorfs_ctx_destroy
+ * @return  The context, or NULL on failure
+ **/
+extern spinorfs_ctx_t *spinorfs_ctx_create(int mtd_fd);
+
+/**
+ * @fn spinorfs_ctx_destroy
+ *
+ * @brief Close the open file, unmount the partition and free the context
+ * @param  ctx [IN] - The spinorfs context, may be NULL
+ **/
+extern void spinorfs_ctx_destroy(spinorfs_ctx_t *ctx);
+
+/**
+ * @fn spinorfs_ctx_gpt_disk_info
+ *
+ * @brief Parse GPT info of the context's device
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  show_gpt [IN] - Show the GPT info into console
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_gpt_disk_info(spinorfs_ctx_t *ctx, int show_gpt);
+
+/**
+ * @fn spinorfs_ctx_gpt_find_guid
+ *
+ * @brief Get offset and size of the partition via GUID, reading the GPT
+ *        only up to the matching entry
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_gpt_find_guid(spinorfs_ctx_t *ctx, uint8_t *guid,
+                                      uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_ctx_gpt_find_name
+ *
+ * @brief Get offset and size of the partition via partition name, reading
+ *        the GPT only up to the matching entry
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_gpt_find_name(spinorfs_ctx_t *ctx, char *part,
+                                      uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_ctx_gpt_part_guid_info
+ *
+ * @brief Get offset and size of the partition via GUID from the partition
+ *        table parsed by spinorfs_ctx_gpt_disk_info
+ * @param  ctx [IN] - The spinorfs context
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_gpt_part_guid_info(spinorfs_ctx_t *ctx, uint8_t *guid,
+                                           uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_ctx_gpt_part_name_info
+ *
+ * @brief Get offset and size of the partition via partition name from the
+ *        partition table parsed by spinorfs_ctx_gpt_disk_info
+ * @param  ctx [IN] - The spinorfs context
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_gpt_part_name_info(spinorfs_ctx_t *ctx, char *part,
+                                           uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn spinorfs_ctx_gpt_get_crc
+ *
+ * @brief Get the CRCs of the last GPT verified for the context's device
+ * @param  ctx [IN] - The spinorfs context
+ * @param  crc [OUT] - CRCs and LBA of the verified GPT header
+ * @return  0 - Success
+ *          1 - Failure, no GPT verified yet
+ **/
+extern int spinorfs_ctx_gpt_get_crc(spinorfs_ctx_t *ctx,
+                                    struct spinorfs_gpt_crc *crc);
+
+/**
+ * @fn spinorfs_ctx_mount
+ *
+ * @brief Mount a partition of the context's device as LittleFS filesystem.
+ *        The littlefs sizes are derived from the MTD device unless set in
+ *        opts. A partition that can't be mounted is formatted, unless it is
+ *        mounted read-only.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  size [IN]   - Size of the partition
+ * @param  offset [IN] - The location of partition in the flash
+ * @param  opts [IN]   - Mount options, NULL for the derived sizes
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_mount(spinorfs_ctx_t *ctx, uint32_t size,
+                              uint32_t offset,
+                              const struct spinorfs_mount_opts *opts);
+
+/**
+ * @fn spinorfs_ctx_unmount
+ *
+ * @brief Unmount the partition of the context and release its buffers
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_unmount(spinorfs_ctx_t *ctx);
+
+/**
+ * @fn spinorfs_ctx_set_cache_size
+ *
+ * @brief Set the number of erase blocks cached for reads. It applies from
+ *        the next mount.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  blocks [IN] - Number of erase blocks, 0 disables the cache
+ **/
+extern void spinorfs_ctx_set_cache_size(spinorfs_ctx_t *ctx, uint32_t blocks);
+
+/**
+ * @fn spinorfs_ctx_set_blank_check
+ *
+ * @brief Enable or disable skipping the erase of blocks already blank
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  enable [IN] - 1 to read the block before erasing it, 0 to always
+ *                       erase
+ **/
+extern void spinorfs_ctx_set_blank_check(spinorfs_ctx_t *ctx, int enable);
+
+/**
+ * @fn spinorfs_ctx_set_compare_write
+ *
+ * @brief Enable or disable skipping the program of pages already holding
+ *        the data
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  enable [IN] - 1 to compare with the flash before programming,
+ *                       0 to always program
+ **/
+extern void spinorfs_ctx_set_compare_write(spinorfs_ctx_t *ctx, int enable);
+
+/**
+ * @fn spinorfs_ctx_get_stats
+ *
+ * @brief Get the statistics of the flash accesses of the context since the
+ *        last reset
+ * @param  ctx [IN] - The spinorfs context
+ * @param  stats [OUT] - Statistics
+ **/
+extern void spinorfs_ctx_get_stats(spinorfs_ctx_t *ctx,
+                                   struct spinorfs_stats *stats);
+
+/**
+ * @fn spinorfs_ctx_reset_stats
+ *
+ * @brief Reset the statistics of the flash accesses of the context
+ * @param  ctx [IN/OUT] - The spinorfs context
+ **/
+extern void spinorfs_ctx_reset_stats(spinorfs_ctx_t *ctx);
+
+/**
+ * @fn spinorfs_ctx_open
+ *
+ * @brief Open file of the mounted partition with specified mode. Several
+ *        files can be open at once, each one with its own position. Only
+ *        SPINORFS_O_RDONLY is allowed on a read-only mount.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  file [IN] - File to be opened
+ * @param  flags [IN] - Access mode to file
+ * @return  The file handle, or NULL on failure
+ **/
+extern spinorfs_file_t *spinorfs_ctx_open(spinorfs_ctx_t *ctx, char *file,
+                                          int flags);
+
+/**
+ * @fn spinorfs_ctx_rename
+ *
+ * @brief Rename a file of the mounted partition, atomically replacing the
+ *        new file if it exists.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  old_file [IN] - File to be renamed
+ * @param  new_file [IN] - New name of the file
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_rename(spinorfs_ctx_t *ctx, char *old_file,
+                               char *new_file);
+
+/**
+ * @fn spinorfs_ctx_remove
+ *
+ * @brief Remove a file of the mounted partition.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  file [IN] - File to be removed
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int spinorfs_ctx_remove(spinorfs_ctx_t *ctx, char *file);
 #endif  /* _SPINORFS_H_ */
\ No newline at end of file
@@ -0,0 +1,161 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "blk_cache.h"
+#include "utils.h"
+
+/**
+ * @fn blk_cache_find
+ *
+ * @brief Find the entry of a cached erase block
+ * @param  cache [IN] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ * @return  The cache entry, or NULL when it is not cached
+ **/
+static blk_cache_entry_t *blk_cache_find(blk_cache_t *cache,
+                                         unsigned long offset)
+{
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        if (cache->entries[i].valid && cache->entries[i].offset == offset) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @fn blk_cache_init
+ *
+ * @brief Allocate the cache entries. The block buffers are allocated on
+ *        first use.
+ * @param  cache [OUT] - Block cache
+ * @param  capacity [IN] - Number of erase blocks to cache, 0 disables it
+ * @param  block_size [IN] - Erase block size in bytes
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int blk_cache_init(blk_cache_t *cache, uint32_t capacity, uint32_t block_size)
+{
+    blk_cache_release(cache);
+    if (capacity == 0) {
+        return EXIT_SUCCESS;
+    }
+    cache->entries = (blk_cache_entry_t *)calloc(capacity,
+                                                 sizeof(*cache->entries));
+    if (cache->entries == NULL) {
+        log_printf(LOG_ERROR, "Can't allocate block cache\n");
+        return EXIT_FAILURE;
+    }
+    cache->capacity = capacity;
+    cache->block_size = block_size;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn blk_cache_release
+ *
+ * @brief Free all cached blocks. The hit/miss counters are kept.
+ * @param  cache [IN/OUT] - Block cache
+ **/
+void blk_cache_release(blk_cache_t *cache)
+{
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        free(cache->entries[i].data);
+    }
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->capacity = 0;
+    cache->block_size = 0;
+    cache->tick = 0;
+}
+
+/**
+ * @fn blk_cache_lookup
+ *
+ * @brief Look up a cached erase block
+ * @param  cache [IN/OUT] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ * @return  Content of the block, or NULL when it is not cached
+ **/
+uint8_t *blk_cache_lookup(blk_cache_t *cache, unsigned long offset)
+{
+    blk_cache_entry_t *entry = blk_cache_find(cache, offset);
+
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    entry->last_use = ++cache->tick;
+    return entry->data;
+}
+
+/**
+ * @fn blk_cache_insert
+ *
+ * @brief Take the least recently used entry for an erase block. The caller
+ *        fills the returned buffer, or invalidates the block on failure.
+ * @param  cache [IN/OUT] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ * @return  Buffer of block_size bytes, or NULL on failure
+ **/
+uint8_t *blk_cache_insert(blk_cache_t *cache, unsigned long offset)
+{
+    blk_cache_entry_t *entry = NULL;
+
+    if (cache->capacity == 0) {
+        return NULL;
+    }
+    /* Prefer a free entry, otherwise evict the least recently used one */
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        if (!cache->entries[i].valid) {
+            entry = &cache->entries[i];
+            break;
+        }
+        if (entry == NULL ||
+            cache->entries[i].last_use < entry->last_use) {
+            entry = &cache->entries[i];
+        }
+    }
+    if (entry->data == NULL) {
+        entry->data = (uint8_t *)malloc(cache->block_size);
+        if (entry->data == NULL) {
+            log_printf(LOG_ERROR, "Can't allocate block cache\n");
+            return NULL;
+        }
+    }
+    entry->offset = offset;
+    entry->last_use = ++cache->tick;
+    entry->valid = 1;
+    return entry->data;
+}
+
+/**
+ * @fn blk_cache_invalidate
+ *
+ * @brief Drop a cached erase block after it was programmed or erased
+ * @param  cache [IN/OUT] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ **/
+void blk_cache_invalidate(blk_cache_t *cache, unsigned long offset)
+{
+    blk_cache_entry_t *entry = blk_cache_find(cache, offset);
+
+    if (entry != NULL) {
+        entry->valid = 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+
+#ifndef _BLK_CACHE_H_
+#define _BLK_CACHE_H_
+
+#include <stdint.h>
+
+/* Number of erase blocks kept in the cache unless Makefile define */
+#ifdef SPINORFS_CACHE_BLOCKS
+#define DEFAULT_CACHE_BLOCKS                SPINORFS_CACHE_BLOCKS
+#else
+#define DEFAULT_CACHE_BLOCKS                8
+#endif
+
+typedef struct blk_cache_entry {
+    uint8_t *data;                          // Content of the erase block
+    unsigned long offset;                   // Flash offset of the erase block
+    uint32_t last_use;                      // Tick of the last access
+    uint8_t valid;
+} blk_cache_entry_t;
+
+typedef struct blk_cache {
+    blk_cache_entry_t *entries;
+    uint32_t capacity;                      // Number of entries, 0 - disabled
+    uint32_t block_size;
+    uint32_t tick;
+    uint64_t hits;
+    uint64_t misses;
+} blk_cache_t;
+
+/**
+ * @fn blk_cache_init
+ *
+ * @brief Allocate the cache entries. The block buffers are allocated on
+ *        first use.
+ * @param  cache [OUT] - Block cache
+ * @param  capacity [IN] - Number of erase blocks to cache, 0 disables it
+ * @param  block_size [IN] - Erase block size in bytes
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int blk_cache_init(blk_cache_t *cache, uint32_t capacity,
+                          uint32_t block_size);
+
+/**
+ * @fn blk_cache_release
+ *
+ * @brief Free all cached blocks. The hit/miss counters are kept.
+ * @param  cache [IN/OUT] - Block cache
+ **/
+extern void blk_cache_release(blk_cache_t *cache);
+
+/**
+ * @fn blk_cache_lookup
+ *
+ * @brief Look up a cached erase block
+ * @param  cache [IN/OUT] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ * @return  Content of the block, or NULL when it is not cached
+ **/
+extern uint8_t *blk_cache_lookup(blk_cache_t *cache, unsigned long offset);
+
+/**
+ * @fn blk_cache_insert
+ *
+ * @brief Take the least recently used entry for an erase block. The caller
+ *        fills the returned buffer, or invalidates the block on failure.
+ * @param  cache [IN/OUT] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ * @return  Buffer of block_size bytes, or NULL on failure
+ **/
+extern uint8_t *blk_cache_insert(blk_cache_t *cache, unsigned long offset);
+
+/**
+ * @fn blk_cache_invalidate
+ *
+ * @brief Drop a cached erase block after it was programmed or erased
+ * @param  cache [IN/OUT] - Block cache
+ * @param  offset [IN] - Flash offset of the erase block
+ **/
+extern void blk_cache_invalidate(blk_cache_t *cache, unsigned long offset);
+
+#endif  /* _BLK_CACHE_H_ */
\ No newline at end of file
@@ -0,0 +1,138 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+/**
+ * @fn crc32_update
+ *
+ * @brief Update a CRC32 (IEEE 802.3, as used by GPT) with more data.
+ *        Uses the ARMv8 CRC32 instructions when the target has them,
+ *        slicing-by-8 tables otherwise.
+ * @param  crc [IN] - CRC32 of the previous data, 0 to start
+ * @param  data [IN] - Data to add
+ * @param  len [IN] - Size of data in bytes
+ * @return  CRC32 of the previous data followed by data
+ **/
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *) data;
+    uint32_t word;
+
+    crc = ~crc;
+    while (len && ((uintptr_t) p & 3)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+#if defined(__aarch64__)
+    while (len >= 8) {
+        uint64_t dword;
+
+        memcpy(&dword, p, sizeof(dword));
+        crc = __crc32d(crc, dword);
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len >= 4) {
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32w(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+    return ~crc;
+}
+
+#else
+
+/* Reflected polynomial of CRC32 */
+#define CRC32_POLY                          0xEDB88320U
+
+/* crc_table[k][b] is the CRC of byte b followed by k zero bytes */
+static uint32_t crc_table[8][256];
+
+/**
+ * @fn crc32_init_table
+ *
+ * @brief Generate the slicing-by-8 tables at load time, before any thread
+ *        can use them
+ **/
+__attribute__((constructor)) static void crc32_init_table(void)
+{
+    uint32_t crc;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        crc = i;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+        }
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        crc = crc_table[0][i];
+        for (int k = 1; k < 8; k++) {
+            crc = crc_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc_table[k][i] = crc;
+        }
+    }
+}
+
+/**
+ * @fn crc32_update
+ *
+ * @brief Update a CRC32 (IEEE 802.3, as used by GPT) with more data.
+ *        Uses the ARMv8 CRC32 instructions when the target has them,
+ *        slicing-by-8 tables otherwise.
+ * @param  crc [IN] - CRC32 of the previous data, 0 to start
+ * @param  data [IN] - Data to add
+ * @param  len [IN] - Size of data in bytes
+ * @return  CRC32 of the previous data followed by data
+ **/
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *) data;
+
+    crc = ~crc;
+    /* Eight bytes per step, read byte-wise so any alignment and endian work */
+    while (len >= 8) {
+        uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 |
+                             (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+
+        crc = crc_table[7][lo & 0xFF] ^
+              crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^
+              crc_table[4][lo >> 24] ^
+              crc_table[3][p[4]] ^
+              crc_table[2][p[5]] ^
+              crc_table[1][p[6]] ^
+              crc_table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @fn crc32_update
+ *
+ * @brief Update a CRC32 (IEEE 802.3, as used by GPT) with more data.
+ *        Uses the ARMv8 CRC32 instructions when the target has them,
+ *        slicing-by-8 tables otherwise.
+ * @param  crc [IN] - CRC32 of the previous data, 0 to start
+ * @param  data [IN] - Data to add
+ * @param  len [IN] - Size of data in bytes
+ * @return  CRC32 of the previous data followed by data
+ **/
+extern uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif  /* _CRC32_H_ */
\ No newline at end of file
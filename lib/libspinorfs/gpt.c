@@ -18,13 +18,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "crc32.h"
 #include "gpt.h"
+#include "gpt_cache.h"
 #include "spinorfs.h"
 
 #include "utils.h"
 
-struct gpt_partition partitions[GPT_ENTRIES];
-static int part_used_num = 0;
+/* Partition table of the spinorfs_gpt_* functions without a context */
+static struct gpt_table default_table = {0};
 
 /* Use default the LBA size unless Makefile define */
 #ifdef GPT_LBA_SIZE
@@ -80,20 +82,16 @@ static void print_partition_name(char *name, int length)
 /**
  * @fn trim_partition_name
  *
- * @brief Trim NULL characters in middle of the GPT partition name
- * @param  name [IN] - The partition name as array bytes
+ * @brief Trim NULL characters in middle of the GPT partition name. The name
+ *        is compacted in place.
+ * @param  name [IN/OUT] - The partition name as array bytes
  * @param  length [IN] - Length of the above array
  **/
 static void trim_partition_name(char *name, int length)
 {
-    int j = 0;
-    char * tmp = (char *)malloc(length * sizeof(char));
-    if (tmp == NULL) {
-        log_printf(LOG_ERROR, "Cannot allocate memory\n");
-        return;
-    }
-    memset(tmp, 0, length);
-    for (int i = 0, k = 0; i < length; i++) {
+    int j = 0, k = 0;
+
+    for (int i = 0; i < length; i++) {
         if (name[i] == 0)
             j++;
         else
@@ -102,51 +100,45 @@ static void trim_partition_name(char *name, int length)
         if (j > 2)
             break;
         else if (j == 0) {
-            tmp[k] = name[i];
+            /* k never passes i, so the unread bytes are not overwritten */
+            name[k] = name[i];
             k++;
         }
     }
-    memcpy(name, tmp, length);
-    free(tmp);
+    memset(name + k, 0, length - k);
 }
 
 /**
- * @fn spinorfs_gpt_disk_info
+ * @fn gpt_set_crc
  *
- * @brief Parse GPT info
+ * @brief Remember the CRCs of the last verified GPT header
+ * @param  table [OUT] - Partition table
+ * @param  ph [IN] - Verified GPT header
+ **/
+static void gpt_set_crc(struct gpt_table *table, const struct gpt_header *ph)
+{
+    table->crc.header_crc32 = ph->header_crc32;
+    table->crc.partition_array_crc32 = ph->partition_array_crc32;
+    table->crc.header_lba = ph->my_lba;
+}
+
+/**
+ * @fn gpt_check_pmbr
+ *
+ * @brief Read and verify the protective MBR
  * @param  dev_fd [IN] - File descriptor of the flash
- * @param  show_gpt [IN] - Show the GPT info into console
+ * @param  lba_buff [OUT] - Buffer of lba_size bytes
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_gpt_disk_info (int dev_fd, int show_gpt)
+static int gpt_check_pmbr(int dev_fd, uint8_t *lba_buff)
 {
-    int ret = EXIT_SUCCESS;
-    uint8_t *lba_buff = NULL;
-    uint8_t *entry_buff = NULL;
-    uint32_t entry_size = GPT_ENTRY_SIZE;
-    uint32_t entry_num = 0;
-    uint64_t start_entry_lba = 0;
-    int tmp = 0;
     int part = -1;
     struct gpt_protective_mbr *pmbr = NULL;
-    struct gpt_header *ph = NULL;
-    struct gpt_partition *pentry = NULL;
-
-    part_used_num = 0;
-    lba_buff = (uint8_t *) malloc(lba_size);
-    if (!lba_buff) {
-        log_printf(LOG_ERROR, "Failed to allocate LBA memory\n");
-        ret = EXIT_FAILURE;
-        return ret;
-    }
-    memset(lba_buff, 0x00, lba_size);
 
     /* read LBA0 - Protective MBR */
-    tmp = read(dev_fd, lba_buff, lba_size);
-    if (tmp != lba_size) {
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+    if (pread(dev_fd, lba_buff, lba_size, 0) != lba_size) {
+        return EXIT_FAILURE;
     }
     pmbr = (struct gpt_protective_mbr *) lba_buff;
     /* Verify MBR signature */
@@ -154,8 +146,7 @@ int spinorfs_gpt_disk_info (int dev_fd, int show_gpt)
         (uint16_t)(pmbr->signature[0] | (pmbr->signature[1]) << 8)) {
         log_printf(LOG_ERROR, "Invalid Protective MBR signature: 0x%x-0x%x\n",
                    pmbr->signature[0], pmbr->signature[1]);
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+        return EXIT_FAILURE;
     }
     /* Verify OSType */
     for (int i = 0 ; i < GPT_PARITION_RECORD_NUM; i++) {
@@ -166,8 +157,7 @@ int spinorfs_gpt_disk_info (int dev_fd, int show_gpt)
     }
     if (part == -1) {
         log_printf(LOG_ERROR, "Invalid MBR partition record\n");
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+        return EXIT_FAILURE;
     }
     /* LBA of the GPT partition header */
     if (pmbr->partition_record[part].starting_lba !=
@@ -175,23 +165,33 @@ int spinorfs_gpt_disk_info (int dev_fd, int show_gpt)
         log_printf(LOG_ERROR,
                    "Invalid starting LBA of GPT Header: %d - 0x%.16llx\n",
                    part, pmbr->partition_record[part].starting_lba);
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+        return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
 
-    memset(lba_buff, 0x00, lba_size);
-    /* seek to LBA1 position for GPT Header */
-    if (lseek(dev_fd, lba_size, SEEK_SET) < 0) {
-        log_printf(LOG_ERROR, "Problem in seek to LBA1\n");
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
-    }
+/**
+ * @fn gpt_read_header
+ *
+ * @brief Read and verify the GPT header, including its CRC32
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  lba [IN] - LBA of the header, primary or backup
+ * @param  lba_buff [OUT] - Buffer of lba_size bytes, holds the GPT header
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int gpt_read_header(int dev_fd, uint64_t lba, uint8_t *lba_buff)
+{
+    struct gpt_header *ph = NULL;
+    uint32_t crc = 0, saved_crc = 0;
 
-    tmp = read(dev_fd, lba_buff, lba_size);
-    if (tmp != lba_size) {
-        log_printf(LOG_ERROR, "Read LBA1 failed\n");
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+    /* read the GPT Header */
+    memset(lba_buff, 0x00, lba_size);
+    if (pread(dev_fd, lba_buff, lba_size, (off_t) lba * lba_size) !=
+        lba_size) {
+        log_printf(LOG_ERROR, "Read LBA%llu failed\n",
+                   (unsigned long long) lba);
+        return EXIT_FAILURE;
     }
     ph = (struct gpt_header *) lba_buff;
     /* Verify GPT Header signature */
@@ -199,90 +199,176 @@ int spinorfs_gpt_disk_info (int dev_fd, int show_gpt)
         log_printf(LOG_ERROR,
                    "Incorrect GPT Header signature: 0x%.16llx\n",
                    ph->signature);
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+        return EXIT_FAILURE;
     }
     /* Verify GPT Header size */
     if (ph->header_size < GPT_HEADER_MIN_SIZE ||
         ph->header_size > (uint32_t)lba_size) {
         log_printf(LOG_ERROR, "GPT Header size incorrect: %d\n",
                    ph->header_size);
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+        return EXIT_FAILURE;
     }
-    /* FIXME Don't need to verify GPT Header CRC */
+    /* Verify GPT Header CRC, calculated with the CRC field zeroed */
+    saved_crc = ph->header_crc32;
+    ph->header_crc32 = 0;
+    crc = crc32_update(0, lba_buff, ph->header_size);
+    ph->header_crc32 = saved_crc;
+    if (crc != saved_crc) {
+        log_printf(LOG_ERROR, "GPT Header CRC incorrect: 0x%.8x - 0x%.8x\n",
+                   saved_crc, crc);
+        return EXIT_FAILURE;
+    }
+    if (ph->my_lba != lba) {
+        log_printf(LOG_ERROR, "Incorrect GPT Header LBA: 0x%.16llx\n",
+                   ph->my_lba);
+        return EXIT_FAILURE;
+    }
+    /* Verify size of partition entry and of the whole array */
+    if (ph->partition_entry_size < GPT_ENTRY_SIZE ||
+        ph->partition_entry_size % GPT_ENTRY_SIZE ||
+        (uint64_t) ph->num_partition_entries * ph->partition_entry_size >
+        GPT_ENTRY_ARRAY_MAX_SIZE) {
+        log_printf(LOG_ERROR, "Invalid partition entry array: %d x 0x%.8x\n",
+                   ph->num_partition_entries, ph->partition_entry_size);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
 
-    /* Get size of partition entry */
-    entry_size = ph->partition_entry_size;
-    if (entry_size < GPT_ENTRY_SIZE) {
-        log_printf(LOG_ERROR, "Invalid partition entry size: 0x%.8x\n",
-                   entry_size);
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+/**
+ * @fn gpt_read_entries
+ *
+ * @brief Read the partition entry array of a GPT header in one read and
+ *        verify its CRC32
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  ph [IN] - Verified GPT header
+ * @param  entry_buff [OUT] - Allocated partition entry array, freed by caller
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int gpt_read_entries(int dev_fd, const struct gpt_header *ph,
+                            uint8_t **entry_buff)
+{
+    ssize_t len = (ssize_t) ph->num_partition_entries *
+                  ph->partition_entry_size;
+    uint32_t crc = 0;
+    uint8_t *buff = NULL;
+
+    /* malloc(0) may return NULL, an empty array is still allocated */
+    buff = (uint8_t *) malloc(len ? len : 1);
+    if (!buff) {
+        log_printf(LOG_ERROR, "Cannot allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    if (pread(dev_fd, buff, len, (off_t) ph->partition_entry_lba * lba_size)
+        != len) {
+        log_printf(LOG_ERROR, "Read failed\n");
+        free(buff);
+        return EXIT_FAILURE;
+    }
+    /* Verify Partition Entry Array CRC */
+    crc = crc32_update(0, buff, len);
+    if (crc != ph->partition_array_crc32) {
+        log_printf(LOG_ERROR,
+                   "Partition Entry Array CRC incorrect: 0x%.8x - 0x%.8x\n",
+                   ph->partition_array_crc32, crc);
+        free(buff);
+        return EXIT_FAILURE;
     }
+    *entry_buff = buff;
+    return EXIT_SUCCESS;
+}
 
-    /* Get number of partition entry */
-    entry_num = ph->num_partition_entries;
+/**
+ * @fn gpt_read_table
+ *
+ * @brief Read and verify the primary GPT header and partition entry array.
+ *        The backup GPT is used when the primary one is damaged.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  lba_buff [OUT] - Buffer of lba_size bytes, holds the GPT header
+ * @param  entry_buff [OUT] - Allocated partition entry array, freed by caller
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int gpt_read_table(int dev_fd, uint8_t *lba_buff, uint8_t **entry_buff)
+{
+    struct gpt_header *ph = (struct gpt_header *) lba_buff;
+    uint64_t backup_lba = 0;
+    off_t dev_size = 0;
 
-    /* Get starting LBA of partition entry */
-    start_entry_lba = ph->partition_entry_lba;
+    if (gpt_read_header(dev_fd, GPT_PRIMARY_LBA, lba_buff) == EXIT_SUCCESS) {
+        if (gpt_read_entries(dev_fd, ph, entry_buff) == EXIT_SUCCESS) {
+            return EXIT_SUCCESS;
+        }
+        backup_lba = ph->alternate_lba;
+    } else {
+        /* The backup header is at the last LBA of the flash */
+        dev_size = lseek(dev_fd, 0, SEEK_END);
+        if (dev_size < 2 * lba_size) {
+            log_printf(LOG_ERROR, "Cannot locate the backup GPT\n");
+            return EXIT_FAILURE;
+        }
+        backup_lba = dev_size / lba_size - 1;
+    }
 
-    /* FIXME Don't need to verify Partition Entry Array CRC */
+    log_printf(LOG_ERROR, "WARN: Primary GPT invalid, use backup GPT at LBA%llu\n",
+               (unsigned long long) backup_lba);
+    if (gpt_read_header(dev_fd, backup_lba, lba_buff) != EXIT_SUCCESS ||
+        gpt_read_entries(dev_fd, ph, entry_buff) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
 
-    /* Display all existing partition info */
-    entry_buff = (uint8_t *) malloc (entry_size * sizeof(uint8_t));
-    if (!entry_buff) {
-        log_printf(LOG_ERROR, "Cannot allocate memory\n");
-        ret = EXIT_FAILURE;
-        goto out_free_lba;
+/**
+ * @fn gpt_scan
+ *
+ * @brief Read and verify the GPT, then call visit for each used entry,
+ *        until visit returns a non-zero value
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  header [OUT] - Verified GPT header
+ * @param  visit [IN] - Called with each used entry and its index
+ * @param  arg [IN/OUT] - Argument passed to visit
+ * @return  0 - Success, 1 - Failure, others - Value returned by visit
+ **/
+static int gpt_scan(int dev_fd, struct gpt_header *header,
+                    int (*visit)(struct gpt_partition *, int, void *),
+                    void *arg)
+{
+    int ret = EXIT_SUCCESS;
+    uint8_t *lba_buff = NULL;
+    uint8_t *entry_buff = NULL;
+    struct gpt_header *ph = NULL;
+    struct gpt_partition *pentry = NULL;
+
+    lba_buff = (uint8_t *) malloc(lba_size);
+    if (!lba_buff) {
+        log_printf(LOG_ERROR, "Failed to allocate LBA memory\n");
+        return EXIT_FAILURE;
     }
-    /* seek to starting partition entry LBA */
-    if (lseek(dev_fd, lba_size * start_entry_lba, SEEK_SET) < 0) {
-        log_printf(LOG_ERROR, "Problem in seek to LBA: 0x%.16llx\n",
-                   start_entry_lba);
+    memset(lba_buff, 0x00, lba_size);
+    if (gpt_check_pmbr(dev_fd, lba_buff) != EXIT_SUCCESS ||
+        gpt_read_table(dev_fd, lba_buff, &entry_buff) != EXIT_SUCCESS) {
         ret = EXIT_FAILURE;
-        goto out_free_entry;
+        goto out_free_lba;
     }
+    ph = (struct gpt_header *) lba_buff;
+    memcpy(header, ph, sizeof(*header));
 
-    for (int i = 0; i < (int)entry_num; i ++) {
-        int used_partition = 0;
-        memset(entry_buff, 0x00, entry_size);
-        tmp = read(dev_fd, entry_buff, entry_size);
-        if (tmp != (int)entry_size) {
-            log_printf(LOG_ERROR, "Read failed\n");
-            ret = EXIT_FAILURE;
-            goto out_free_entry;
-        }
-        pentry = (struct gpt_partition *) entry_buff;
-
+    for (uint32_t i = 0; i < ph->num_partition_entries; i++) {
+        pentry = (struct gpt_partition *)
+                 (entry_buff + (size_t) i * ph->partition_entry_size);
         /* Verify if the partition is used */
-        used_partition = is_used_partition(pentry);
-        if (used_partition) {
-            if (show_gpt) {
-                log_printf(LOG_NORMAL, "[GPT Partition #%d]\n", i);
-                log_printf(LOG_NORMAL, "  Name: ");
-                print_partition_name((char *)pentry->partition_name,
-                                     GPT_NAME_LEN);
-                log_printf(LOG_NORMAL, "\n");
-                log_printf(LOG_NORMAL, "  GUID: ");
-                print_guid(pentry->unique_partition_guid);
-                log_printf(LOG_NORMAL, "\n");
-                log_printf(LOG_NORMAL,
-                           "--------------------------------------------\n");
-            } else {
-                /* Remove NULL character from partition name */
-                trim_partition_name((char *)pentry->partition_name,
-                                     GPT_NAME_LEN);
-            }
-            memcpy(&partitions[part_used_num], (void *)entry_buff,
-                   entry_size * sizeof(uint8_t));
-            part_used_num++;
+        if (!is_used_partition(pentry)) {
+            continue;
+        }
+        ret = visit(pentry, (int) i, arg);
+        if (ret != EXIT_SUCCESS) {
+            break;
         }
     }
 
-out_free_entry:
-    if (entry_buff)
-        free(entry_buff);
+    free(entry_buff);
 out_free_lba:
     if (lba_buff)
         free(lba_buff);
@@ -290,61 +376,433 @@ out_free_lba:
     return ret;
 }
 
+/* Argument of the gpt_table_add visitor */
+struct gpt_table_visit {
+    struct gpt_table *table;
+    int show_gpt;
+};
+
 /**
- * @fn spinorfs_gpt_part_guid_info
+ * @fn gpt_table_add
+ *
+ * @brief gpt_scan visitor storing the entry into the partition table, and
+ *        printing it when asked
+ * @param  entry [IN] - Used partition entry
+ * @param  index [IN] - Index of the entry in the array
+ * @param  arg [IN/OUT] - The gpt_table_visit
+ * @return  0 - Continue
+ *          1 - Failure
+ **/
+static int gpt_table_add(struct gpt_partition *entry, int index, void *arg)
+{
+    struct gpt_table_visit *visit = (struct gpt_table_visit *)arg;
+    struct gpt_table *table = visit->table;
+
+    if (table->count >= GPT_ENTRIES) {
+        log_printf(LOG_ERROR, "Too many GPT partitions\n");
+        return EXIT_FAILURE;
+    }
+    if (visit->show_gpt) {
+        log_printf(LOG_NORMAL, "[GPT Partition #%d]\n", index);
+        log_printf(LOG_NORMAL, "  Name: ");
+        print_partition_name((char *)entry->partition_name,
+                             GPT_NAME_LEN);
+        log_printf(LOG_NORMAL, "\n");
+        log_printf(LOG_NORMAL, "  GUID: ");
+        print_guid(entry->unique_partition_guid);
+        log_printf(LOG_NORMAL, "\n");
+        log_printf(LOG_NORMAL,
+                   "--------------------------------------------\n");
+    }
+    /* Remove NULL character from partition name */
+    trim_partition_name((char *)entry->partition_name, GPT_NAME_LEN);
+    memcpy(&table->partitions[table->count], entry, sizeof(*entry));
+    table->count++;
+    return EXIT_SUCCESS;
+}
+
+/* Partition searched by gpt_find_part */
+struct gpt_lookup {
+    const char *name;
+    const uint8_t *guid;
+    struct gpt_partition found;
+};
+
+/**
+ * @fn gpt_find_part
+ *
+ * @brief gpt_scan visitor stopping at the partition matching the name or
+ *        GUID of the lookup
+ * @param  entry [IN] - Used partition entry
+ * @param  index [IN] - Index of the entry in the array
+ * @param  arg [IN/OUT] - The gpt_lookup
+ * @return  0 - Continue
+ *          GPT_PART_FOUND - Partition found
+ **/
+static int gpt_find_part(struct gpt_partition *entry, int index, void *arg)
+{
+    struct gpt_lookup *lookup = (struct gpt_lookup *)arg;
+
+    UN_USED(index);
+
+    if (lookup->guid != NULL) {
+        if (memcmp(lookup->guid, entry->unique_partition_guid,
+                   GUID_BYTE_SIZE) != 0) {
+            return EXIT_SUCCESS;
+        }
+    } else {
+        trim_partition_name((char *)entry->partition_name, GPT_NAME_LEN);
+        if (strncmp(lookup->name, (char *)entry->partition_name,
+                    GPT_NAME_LEN) != 0) {
+            return EXIT_SUCCESS;
+        }
+    }
+    memcpy(&lookup->found, entry, sizeof(*entry));
+    return GPT_PART_FOUND;
+}
+
+/**
+ * @fn gpt_lookup_part
+ *
+ * @brief Scan the GPT up to the partition matching the name or GUID
+ * @param  table [OUT] - Partition table, only its CRCs are updated
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  lookup [IN/OUT] - Name or GUID to search, receives the entry
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int gpt_lookup_part(struct gpt_table *table, int dev_fd,
+                           struct gpt_lookup *lookup,
+                           uint32_t *offset, uint32_t *size)
+{
+    struct gpt_header header;
+    int ret = gpt_scan(dev_fd, &header, gpt_find_part, lookup);
+
+    if (ret == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    gpt_set_crc(table, &header);
+    if (ret != GPT_PART_FOUND) {
+        return EXIT_FAILURE;
+    }
+    *offset = lookup->found.starting_lba * lba_size;
+    *size = (lookup->found.ending_lba -
+             lookup->found.starting_lba + 1) * lba_size;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn gpt_disk_info
+ *
+ * @brief Build the partition table. It is loaded from the GPT cache when the
+ *        GPT header at LBA1 matches the cached one, otherwise the GPT is
+ *        scanned and the cache refreshed.
+ * @param  table [OUT] - Partition table
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  show_gpt [IN] - Show the GPT info into console, skips the cache
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int gpt_disk_info(struct gpt_table *table, int dev_fd, int show_gpt)
+{
+    int ret = EXIT_SUCCESS;
+    int cached = 0;
+    uint8_t *lba_buff = NULL;
+    struct gpt_header header;
+    struct gpt_table_visit visit = {table, show_gpt};
+
+    if (!show_gpt && gpt_cache_enabled()) {
+        lba_buff = (uint8_t *) malloc(lba_size);
+        if (!lba_buff) {
+            log_printf(LOG_ERROR, "Failed to allocate LBA memory\n");
+            return EXIT_FAILURE;
+        }
+        /* Only LBA1 is read when the cached table is still valid */
+        if (gpt_read_header(dev_fd, GPT_PRIMARY_LBA, lba_buff) ==
+            EXIT_SUCCESS) {
+            cached = gpt_cache_load(dev_fd, (struct gpt_header *) lba_buff,
+                                    table->partitions, GPT_ENTRIES,
+                                    &table->count) == EXIT_SUCCESS;
+            if (cached) {
+                gpt_set_crc(table, (struct gpt_header *) lba_buff);
+            }
+        }
+        free(lba_buff);
+        if (cached) {
+            return EXIT_SUCCESS;
+        }
+    }
+
+    table->count = 0;
+    ret = gpt_scan(dev_fd, &header, gpt_table_add, &visit);
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
+    gpt_set_crc(table, &header);
+    /* The cache is checked against LBA1, a backup GPT is never cached */
+    if (gpt_cache_enabled() && header.my_lba == GPT_PRIMARY_LBA) {
+        gpt_cache_store(dev_fd, &header, table->partitions, table->count);
+    }
+    return ret;
+}
+
+/**
+ * @fn gpt_get_crc
+ *
+ * @brief Get the CRCs of the last GPT verified for the partition table
+ * @param  table [IN] - Partition table
+ * @param  crc [OUT] - CRCs and LBA of the verified GPT header
+ * @return  0 - Success
+ *          1 - Failure, no GPT verified yet
+ **/
+int gpt_get_crc(const struct gpt_table *table, struct spinorfs_gpt_crc *crc)
+{
+    if (table->crc.header_lba == 0) {
+        return EXIT_FAILURE;
+    }
+    memcpy(crc, &table->crc, sizeof(*crc));
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn gpt_find_guid
+ *
+ * @brief Get offset and size of the partition via GUID, reading the GPT
+ *        only up to the matching entry. The partition table is only built
+ *        when the GPT cache is enabled.
+ * @param  table [OUT] - Partition table
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int gpt_find_guid(struct gpt_table *table, int dev_fd, uint8_t *guid,
+                  uint32_t *offset, uint32_t *size)
+{
+    struct gpt_lookup lookup = {0};
+
+    /* The cached table avoids reading the entry array at all */
+    if (gpt_cache_enabled()) {
+        if (gpt_disk_info(table, dev_fd, SHOW_GPT_DISABLE) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        return gpt_part_guid_info(table, guid, offset, size);
+    }
+    lookup.guid = guid;
+    if (gpt_lookup_part(table, dev_fd, &lookup, offset, size) !=
+        EXIT_SUCCESS) {
+        log_printf(LOG_ERROR, "not found GUID\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn gpt_find_name
+ *
+ * @brief Get offset and size of the partition via partition name, reading
+ *        the GPT only up to the matching entry. The partition table is only
+ *        built when the GPT cache is enabled.
+ * @param  table [OUT] - Partition table
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int gpt_find_name(struct gpt_table *table, int dev_fd, char *part,
+                  uint32_t *offset, uint32_t *size)
+{
+    struct gpt_lookup lookup = {0};
+
+    /* The cached table avoids reading the entry array at all */
+    if (gpt_cache_enabled()) {
+        if (gpt_disk_info(table, dev_fd, SHOW_GPT_DISABLE) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        return gpt_part_name_info(table, part, offset, size);
+    }
+    lookup.name = part;
+    if (gpt_lookup_part(table, dev_fd, &lookup, offset, size) !=
+        EXIT_SUCCESS) {
+        log_printf(LOG_ERROR, "not found name:%s\n", part);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn gpt_part_guid_info
  *
  * @brief Get offset and size of the partition via GUID
+ * @param  table [IN] - Partition table
  * @param  guid [IN] - Partition GUID number
  * @param  offset [OUT] - The partition offset at the flash
  * @param  size [OUT] - The partition size in byte
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_gpt_part_guid_info(uint8_t *guid, uint32_t *offset, uint32_t *size)
+int gpt_part_guid_info(const struct gpt_table *table, uint8_t *guid,
+                       uint32_t *offset, uint32_t *size)
 {
     int i = 0, ret = EXIT_SUCCESS;
-    for (i = 0; i < part_used_num; i++) {
-        if (memcmp(guid, partitions[i].unique_partition_guid,
+    for (i = 0; i < table->count; i++) {
+        if (memcmp(guid, table->partitions[i].unique_partition_guid,
             GUID_BYTE_SIZE * sizeof(uint8_t)) == 0) {
-            *offset = partitions[i].starting_lba * lba_size;
-            *size = (partitions[i].ending_lba -
-                     partitions[i].starting_lba + 1) * lba_size;
+            *offset = table->partitions[i].starting_lba * lba_size;
+            *size = (table->partitions[i].ending_lba -
+                     table->partitions[i].starting_lba + 1) * lba_size;
             break;
         }
     }
-    if (i == part_used_num) {
-        log_printf(LOG_ERROR, "not found GUID, part num:%d\n", part_used_num);
+    if (i == table->count) {
+        log_printf(LOG_ERROR, "not found GUID, part num:%d\n", table->count);
         ret = EXIT_FAILURE;
     }
     return ret;
 }
 
 /**
- * @fn spinorfs_gpt_part_name_info
+ * @fn gpt_part_name_info
  *
  * @brief Get offset and size of the partition via partition name
+ * @param  table [IN] - Partition table
  * @param  part [IN] - Partition name
  * @param  offset [OUT] - The partition offset at the flash
  * @param  size [OUT] - The partition size in byte
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_gpt_part_name_info(char *part, uint32_t *offset, uint32_t *size)
+int gpt_part_name_info(const struct gpt_table *table, char *part,
+                       uint32_t *offset, uint32_t *size)
 {
     int i = 0, ret = EXIT_SUCCESS;
 
-    for (i = 0; i < part_used_num; i++) {
-        if (strcmp(part, (char *)partitions[i].partition_name) == 0) {
-            *offset = partitions[i].starting_lba * lba_size;
-            *size = (partitions[i].ending_lba -
-                     partitions[i].starting_lba + 1) * lba_size;
+    for (i = 0; i < table->count; i++) {
+        if (strcmp(part, (char *)table->partitions[i].partition_name) == 0) {
+            *offset = table->partitions[i].starting_lba * lba_size;
+            *size = (table->partitions[i].ending_lba -
+                     table->partitions[i].starting_lba + 1) * lba_size;
             break;
         }
     }
-    if (i == part_used_num) {
+    if (i == table->count) {
         log_printf(LOG_ERROR, "not found name:%s, part num:%d\n",
-                   part, part_used_num);
+                   part, table->count);
         ret = EXIT_FAILURE;
     }
     return ret;
+}
+
+/**
+ * @fn spinorfs_gpt_disk_info
+ *
+ * @brief Parse GPT info
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  show_gpt [IN] - Show the GPT info into console
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_gpt_disk_info (int dev_fd, int show_gpt)
+{
+    return gpt_disk_info(&default_table, dev_fd, show_gpt);
+}
+
+/**
+ * @fn spinorfs_gpt_get_crc
+ *
+ * @brief Get the CRCs of the last GPT header and partition entry array
+ *        verified by spinorfs_gpt_disk_info or spinorfs_gpt_find_*
+ * @param  crc [OUT] - CRCs and LBA of the verified GPT header
+ * @return  0 - Success
+ *          1 - Failure, no GPT verified yet
+ **/
+int spinorfs_gpt_get_crc(struct spinorfs_gpt_crc *crc)
+{
+    return gpt_get_crc(&default_table, crc);
+}
+
+/**
+ * @fn spinorfs_gpt_set_cache_dir
+ *
+ * @brief Set the directory of the GPT cache files
+ * @param  dir [IN] - Directory, NULL disables the cache
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_gpt_set_cache_dir(const char *dir)
+{
+    return gpt_cache_set_dir(dir);
+}
+
+/**
+ * @fn spinorfs_gpt_find_guid
+ *
+ * @brief Get offset and size of the partition via GUID, reading the GPT
+ *        only up to the matching entry. The partition table is not built.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_gpt_find_guid(int dev_fd, uint8_t *guid,
+                           uint32_t *offset, uint32_t *size)
+{
+    return gpt_find_guid(&default_table, dev_fd, guid, offset, size);
+}
+
+/**
+ * @fn spinorfs_gpt_find_name
+ *
+ * @brief Get offset and size of the partition via partition name, reading
+ *        the GPT only up to the matching entry. The partition table is not
+ *        built.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_gpt_find_name(int dev_fd, char *part,
+                           uint32_t *offset, uint32_t *size)
+{
+    return gpt_find_name(&default_table, dev_fd, part, offset, size);
+}
+
+/**
+ * @fn spinorfs_gpt_part_guid_info
+ *
+ * @brief Get offset and size of the partition via GUID
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_gpt_part_guid_info(uint8_t *guid, uint32_t *offset, uint32_t *size)
+{
+    return gpt_part_guid_info(&default_table, guid, offset, size);
+}
+
+/**
+ * @fn spinorfs_gpt_part_name_info
+ *
+ * @brief Get offset and size of the partition via partition name
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_gpt_part_name_info(char *part, uint32_t *offset, uint32_t *size)
+{
+    return gpt_part_name_info(&default_table, part, offset, size);
 }
\ No newline at end of file
@@ -14,6 +14,10 @@
 #ifndef _GPT_H_
 #define _GPT_H_
 
+#include <stdint.h>
+
+#include "spinorfs.h"
+
 #define MBR_BOOTCODE_SIZE                   440
 #define GPT_NAME_LEN                        72
 #define GPT_ENTRIES                         128
@@ -22,6 +26,10 @@
 #define GPT_PARITION_RECORD_NUM             4
 #define GPT_HEADER_MIN_SIZE                 92
 #define GPT_GUID_SIZE                       16
+/* Largest partition entry array accepted, read and verified at once */
+#define GPT_ENTRY_ARRAY_MAX_SIZE            (1024 * 1024)
+/* Returned by a gpt_scan visitor to stop at the searched partition */
+#define GPT_PART_FOUND                      2
 
 /* Signature - "EFI PART" */
 #define GPT_HEADER_SIGNATURE                0x5452415020494645ULL
@@ -79,4 +87,104 @@ struct gpt_header {
     uint32_t partition_array_crc32;
 } __attribute__((packed));
 
+/* Partition table built from the GPT, one per spinorfs context */
+struct gpt_table {
+    struct gpt_partition partitions[GPT_ENTRIES];
+    int count;                              // Used entries of partitions
+    struct spinorfs_gpt_crc crc;            // header_lba 0 until verified
+};
+
+/* LBA size of the flash */
+extern int lba_size;
+
+/**
+ * @fn gpt_disk_info
+ *
+ * @brief Build the partition table. It is loaded from the GPT cache when the
+ *        GPT header at LBA1 matches the cached one, otherwise the GPT is
+ *        scanned and the cache refreshed.
+ * @param  table [OUT] - Partition table
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  show_gpt [IN] - Show the GPT info into console, skips the cache
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_disk_info(struct gpt_table *table, int dev_fd, int show_gpt);
+
+/**
+ * @fn gpt_get_crc
+ *
+ * @brief Get the CRCs of the last GPT verified for the partition table
+ * @param  table [IN] - Partition table
+ * @param  crc [OUT] - CRCs and LBA of the verified GPT header
+ * @return  0 - Success
+ *          1 - Failure, no GPT verified yet
+ **/
+extern int gpt_get_crc(const struct gpt_table *table,
+                       struct spinorfs_gpt_crc *crc);
+
+/**
+ * @fn gpt_find_guid
+ *
+ * @brief Get offset and size of the partition via GUID. With the GPT
+ *        cache enabled (the default) the cached partition table is used, or
+ *        built from the whole GPT when the cache is stale. Otherwise the GPT
+ *        is read only up to the matching entry and no table is built.
+ * @param  table [OUT] - Partition table
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_find_guid(struct gpt_table *table, int dev_fd, uint8_t *guid,
+                         uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn gpt_find_name
+ *
+ * @brief Get offset and size of the partition via partition name. With the GPT
+ *        cache enabled (the default) the cached partition table is used, or
+ *        built from the whole GPT when the cache is stale. Otherwise the GPT
+ *        is read only up to the matching entry and no table is built.
+ * @param  table [OUT] - Partition table
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_find_name(struct gpt_table *table, int dev_fd, char *part,
+                         uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn gpt_part_guid_info
+ *
+ * @brief Get offset and size of the partition via GUID
+ * @param  table [IN] - Partition table
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_part_guid_info(const struct gpt_table *table, uint8_t *guid,
+                              uint32_t *offset, uint32_t *size);
+
+/**
+ * @fn gpt_part_name_info
+ *
+ * @brief Get offset and size of the partition via partition name
+ * @param  table [IN] - Partition table
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_part_name_info(const struct gpt_table *table, char *part,
+                              uint32_t *offset, uint32_t *size);
+
 #endif  /* _GPT_H_ */
\ No newline at end of file
@@ -0,0 +1,205 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gpt_cache.h"
+#include "utils.h"
+
+/* Empty when the cache is disabled */
+static char cache_dir[PATH_MAX] = DEFAULT_GPT_CACHE_DIR;
+
+/**
+ * @fn gpt_cache_key
+ *
+ * @brief Build the cache file header and path of the device
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  ph [IN] - GPT header read from the flash
+ * @param  key [OUT] - Expected cache file header, count is left 0
+ * @param  path [OUT] - Path of the cache file
+ * @param  len [IN] - Size of path
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int gpt_cache_key(int dev_fd, const struct gpt_header *ph,
+                         struct gpt_cache_header *key, char *path, size_t len)
+{
+    struct stat st;
+    int ret = 0;
+
+    if (cache_dir[0] == '\0' || fstat(dev_fd, &st) < 0) {
+        return EXIT_FAILURE;
+    }
+    memset(key, 0, sizeof(*key));
+    key->magic = GPT_CACHE_MAGIC;
+    key->version = GPT_CACHE_VERSION;
+    key->dev = (uint64_t) st.st_dev;
+    key->ino = (uint64_t) st.st_ino;
+    key->rdev = (uint64_t) st.st_rdev;
+    key->lba_size = (uint32_t) lba_size;
+    memcpy(key->gpt_header, ph, sizeof(key->gpt_header));
+
+    ret = snprintf(path, len, "%s/spinorfs-gpt-%llx-%llx-%llx.cache",
+                   cache_dir, (unsigned long long) key->dev,
+                   (unsigned long long) key->ino,
+                   (unsigned long long) key->rdev);
+    if (ret < 0 || (size_t) ret >= len) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn gpt_cache_load
+ *
+ * @brief Load the partition table cached for the device, if the cache was
+ *        made from the same GPT header
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  ph [IN] - GPT header read from the flash
+ * @param  table [OUT] - Partition table
+ * @param  max [IN] - Number of entries of table
+ * @param  count [OUT] - Number of partitions loaded
+ * @return  0 - Success
+ *          1 - No valid cache
+ **/
+int gpt_cache_load(int dev_fd, const struct gpt_header *ph,
+                   struct gpt_partition *table, int max, int *count)
+{
+    int ret = EXIT_FAILURE;
+    int fd = -1;
+    char path[PATH_MAX];
+    struct gpt_cache_header key, hdr;
+    struct stat st;
+    ssize_t len = 0;
+
+    if (gpt_cache_key(dev_fd, ph, &key, path, sizeof(path))) {
+        return EXIT_FAILURE;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr)) {
+        goto out;
+    }
+    /* Same device, same GPT header and CRCs */
+    key.count = hdr.count;
+    if (memcmp(&key, &hdr, sizeof(key)) != 0 || (int) hdr.count > max) {
+        log_printf(LOG_DEBUG, "GPT cache %s is stale\n", path);
+        goto out;
+    }
+    len = (ssize_t) hdr.count * sizeof(*table);
+    if (fstat(fd, &st) < 0 || st.st_size != (off_t) sizeof(hdr) + len ||
+        pread(fd, table, len, sizeof(hdr)) != len) {
+        goto out;
+    }
+    *count = (int) hdr.count;
+    log_printf(LOG_DEBUG, "GPT loaded from %s\n", path);
+    ret = EXIT_SUCCESS;
+out:
+    close(fd);
+    return ret;
+}
+
+/**
+ * @fn gpt_cache_store
+ *
+ * @brief Save the partition table of the device. The file is replaced
+ *        atomically so concurrent readers see the old or the new table.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  ph [IN] - GPT header read from the flash
+ * @param  table [IN] - Partition table
+ * @param  count [IN] - Number of partitions
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int gpt_cache_store(int dev_fd, const struct gpt_header *ph,
+                    const struct gpt_partition *table, int count)
+{
+    int ret = EXIT_FAILURE;
+    int fd = -1;
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    struct gpt_cache_header hdr;
+    ssize_t len = (ssize_t) count * sizeof(*table);
+
+    if (gpt_cache_key(dev_fd, ph, &hdr, path, sizeof(path))) {
+        return EXIT_FAILURE;
+    }
+    hdr.count = (uint32_t) count;
+
+    /* Each writer uses its own file, renamed over the cache when complete */
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        log_printf(LOG_DEBUG, "Can't create GPT cache %s\n", tmp);
+        return EXIT_FAILURE;
+    }
+    if (write(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr) &&
+        write(fd, table, len) == len && close(fd) == 0) {
+        fd = -1;
+        if (rename(tmp, path) == 0) {
+            ret = EXIT_SUCCESS;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (ret != EXIT_SUCCESS) {
+        log_printf(LOG_DEBUG, "Can't write GPT cache %s\n", path);
+        unlink(tmp);
+    }
+    return ret;
+}
+
+/**
+ * @fn gpt_cache_set_dir
+ *
+ * @brief Set the directory of the cache files
+ * @param  dir [IN] - Directory, NULL disables the cache
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int gpt_cache_set_dir(const char *dir)
+{
+    if (dir == NULL) {
+        cache_dir[0] = '\0';
+        return EXIT_SUCCESS;
+    }
+    if (strlen(dir) >= sizeof(cache_dir)) {
+        log_printf(LOG_ERROR, "GPT cache directory is too long\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(cache_dir, dir);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn gpt_cache_enabled
+ *
+ * @brief Check if the GPT cache is used
+ * @return  1 - Enabled
+ *          0 - Disabled
+ **/
+int gpt_cache_enabled(void)
+{
+    return cache_dir[0] != '\0';
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+
+#ifndef _GPT_CACHE_H_
+#define _GPT_CACHE_H_
+
+#include <stdint.h>
+
+#include "gpt.h"
+
+/* Directory of the GPT cache files unless Makefile define */
+#ifdef SPINORFS_GPT_CACHE_DIR
+#define DEFAULT_GPT_CACHE_DIR               SPINORFS_GPT_CACHE_DIR
+#else
+#define DEFAULT_GPT_CACHE_DIR               "/run"
+#endif
+
+/* Signature - "GPTC" */
+#define GPT_CACHE_MAGIC                     0x43545047U
+#define GPT_CACHE_VERSION                   1
+
+/* Header of a cache file, followed by count partition entries */
+struct gpt_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t dev;                           // Identity of the flash device
+    uint64_t ino;
+    uint64_t rdev;
+    uint32_t lba_size;
+    uint32_t count;
+    uint8_t gpt_header[GPT_HEADER_MIN_SIZE];    // Includes both CRC32
+} __attribute__((packed));
+
+/**
+ * @fn gpt_cache_load
+ *
+ * @brief Load the partition table cached for the device, if the cache was
+ *        made from the same GPT header
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  ph [IN] - GPT header read from the flash
+ * @param  table [OUT] - Partition table
+ * @param  max [IN] - Number of entries of table
+ * @param  count [OUT] - Number of partitions loaded
+ * @return  0 - Success
+ *          1 - No valid cache
+ **/
+extern int gpt_cache_load(int dev_fd, const struct gpt_header *ph,
+                          struct gpt_partition *table, int max, int *count);
+
+/**
+ * @fn gpt_cache_store
+ *
+ * @brief Save the partition table of the device. The file is replaced
+ *        atomically so concurrent readers see the old or the new table.
+ * @param  dev_fd [IN] - File descriptor of the flash
+ * @param  ph [IN] - GPT header read from the flash
+ * @param  table [IN] - Partition table
+ * @param  count [IN] - Number of partitions
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_cache_store(int dev_fd, const struct gpt_header *ph,
+                           const struct gpt_partition *table, int count);
+
+/**
+ * @fn gpt_cache_set_dir
+ *
+ * @brief Set the directory of the cache files
+ * @param  dir [IN] - Directory, NULL disables the cache
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+extern int gpt_cache_set_dir(const char *dir);
+
+/**
+ * @fn gpt_cache_enabled
+ *
+ * @brief Check if the GPT cache is used
+ * @return  1 - Enabled
+ *          0 - Disabled
+ **/
+extern int gpt_cache_enabled(void);
+
+#endif  /* _GPT_CACHE_H_ */
\ No newline at end of file
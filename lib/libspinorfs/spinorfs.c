@@ -21,101 +21,174 @@
 #include <unistd.h>
 #include <limits.h>
 #include <stdint.h>
+#include <time.h>
 #include <mtd/mtd-user.h>
 
 #include "lfs.h"
 #include "spinorfs.h"
 #include "utils.h"
+#include "blk_cache.h"
+#include "gpt.h"
 
 #define DEFAULT_SPI_PAGE_SIZE       4096
 #define DEFAULT_READ_PRO_SIZE       512
 #define DEFAULT_LFS_BLOCK_CYCLE     (-1)
-/* Purpose: block-level wear-leveling */
-#define DEFAULT_LFS_LOOKAHEAD_SIZE  16
+/* The lookahead buffer holds one bit per block, in multiples of 8 bytes */
+#define LFS_LOOKAHEAD_ALIGN         8
+
+/* Skip the erase of blocks already blank unless Makefile define */
+#ifdef SPINORFS_BLANK_CHECK
+#define DEFAULT_BLANK_CHECK         SPINORFS_BLANK_CHECK
+#else
+#define DEFAULT_BLANK_CHECK         1
+#endif
+
+/* Skip programming pages already holding the data unless Makefile define */
+#ifdef SPINORFS_COMPARE_WRITE
+#define DEFAULT_COMPARE_WRITE       SPINORFS_COMPARE_WRITE
+#else
+#define DEFAULT_COMPARE_WRITE       1
+#endif
+
+/* An MTD device, its partition table and the partition mounted on it */
+struct spinorfs_ctx {
+    int dev_fd;                     // MTD device, closed by the caller
+    struct mtd_info_user mtd;       // Geometry of the MTD device
+    struct gpt_table gpt;           // Partition table of the device
+
+    /* lfs definition and control buffer for flash SPI-NOR */
+    lfs_t lfs;
+    struct lfs_config cfg;
+    uint8_t mounted;
+    uint8_t read_only;              // Mounted without write access
+    struct spinorfs_file *files;    // Files open on the mounted partition
+
+    /* Read, program and lookahead buffers, sized at mount */
+    uint8_t *read_buf;
+    uint8_t *prog_buf;
+    uint8_t *lookahead_buf;
+
+    lfs_off_t offset;               // Flash offset to mount the partition
+    lfs_size_t part_size;           // Partition size
+
+    /* Erase blocks read by littlefs, dropped when programmed or erased */
+    blk_cache_t cache;
+    uint32_t cache_blocks;
+
+    uint8_t blank_check;
+    uint64_t erase_count;
+    uint64_t erase_skipped;
+    uint64_t erase_ioctls;
+    uint64_t erase_time_us;
+
+    uint8_t compare_write;
+    uint64_t pages_programmed;
+    uint64_t pages_skipped;
+};
+
+/* A file open on the mounted partition of a context */
+struct spinorfs_file {
+    spinorfs_ctx_t *ctx;            // Context of the mounted partition
+    lfs_file_t file;
+    lfs_soff_t pos;                 // Position in the file, -1 if unknown
+    uint8_t append;                 // Opened with SPINORFS_O_APPEND
+    struct spinorfs_file *next;     // Next file open in the context
+};
+
+/* Context of the spinorfs_* functions without a context argument */
+static spinorfs_ctx_t default_ctx = {
+    .dev_fd = -1,
+    .cache_blocks = DEFAULT_CACHE_BLOCKS,
+    .blank_check = DEFAULT_BLANK_CHECK,
+    .compare_write = DEFAULT_COMPARE_WRITE,
+};
 
-struct mtd_info_user mtd;
-struct erase_info_user erase;
-
-static int dev_fd = -1;
-
-/* lfs definition and control buffer for flash SPI-NOR */
-lfs_t lfs_flash = {0};
-lfs_file_t file_flash = {0};
-
-/* statically allocated read buffer */
-uint8_t lfs_read_buf[DEFAULT_READ_PRO_SIZE];
-/* statically allocated program buffer */
-uint8_t lfs_prog_buf[DEFAULT_READ_PRO_SIZE];
-/* statically allocated lookahead buffer (track 128*8=1024 blocks) */
-uint8_t lfs_lookahead_buf[DEFAULT_LFS_LOOKAHEAD_SIZE];
-
-struct lfs_config cfg_flash = {0};
+/**
+ * @fn flash_elapsed_us
+ *
+ * @brief Microseconds elapsed since a monotonic time stamp
+ * @param  start [IN] - Time stamp taken with CLOCK_MONOTONIC
+ * @return  Elapsed time in microseconds
+ **/
+static uint64_t flash_elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
 
-/* Flash offset to mount the partition */
-lfs_off_t lfs_offset = 0;
-/* Partition size */
-lfs_size_t lfs_part_size = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000 +
+           (now.tv_nsec - start->tv_nsec) / 1000;
+}
 
 /**
  * @fn flash_erase
  *
  * @brief Erase the content of given SPI NOR device, at given offset and length.
- * @param  fd [IN] - The file descriptor of SPI NOR device to be erased
+ * @param  ctx [IN/OUT] - The spinorfs context of the SPI NOR device
  * @param  offset [IN] - The offset in SPI NOR device to begin erasing
  * @param  length [IN] - Number of bytes will be erased
  * @return  0 - Success
  *         -1 - Failure
  **/
-static int flash_erase(int fd, unsigned long offset, unsigned long length)
+static int flash_erase(spinorfs_ctx_t *ctx, unsigned long offset,
+                       unsigned long length)
 {
     int i, blocks;
+    int ret = 0;
+    struct timespec start;
+    struct erase_info_user erase;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     erase.start = offset;
-    erase.length = (length + mtd.erasesize - 1) / mtd.erasesize;
-    erase.length *= mtd.erasesize;
+    erase.length = (length + ctx->mtd.erasesize - 1) / ctx->mtd.erasesize;
+    erase.length *= ctx->mtd.erasesize;
 
-    blocks = erase.length / mtd.erasesize;
-    erase.length = mtd.erasesize;
+    blocks = erase.length / ctx->mtd.erasesize;
+    erase.length = ctx->mtd.erasesize;
 
     /* Erasing required flash sector based on input file size */
     for (i = 1; i <= blocks; i++) {
-        log_printf(LOG_DEBUG, "\rErasing blocks: %d/%d (%d%%)",
-            i, blocks, PERCENTAGE(i, blocks));
-        if (ioctl(fd, MEMERASE, &erase) < 0) {
+        ctx->erase_ioctls++;
+        if (ioctl(ctx->dev_fd, MEMERASE, &erase) < 0) {
             log_printf(LOG_ERROR,
                 "Error While erasing blocks 0x%.8x-0x%.8x: %m\n",
                 (unsigned int) erase.start,
                 (unsigned int) (erase.start + erase.length));
-            return -1;
+            ret = -1;
+            goto out;
         }
-        erase.start += mtd.erasesize;
+        erase.start += ctx->mtd.erasesize;
     }
 
-    log_printf(LOG_DEBUG, "\rErasing blocks: %d/%d (100%%)\n",
-        blocks, blocks);
-
-    return 0;
+out:
+    ctx->erase_time_us += flash_elapsed_us(&start);
+    if (ret == 0) {
+        log_printf(LOG_DEBUG, "Erased %d blocks at 0x%.8lx\n", blocks,
+                   offset);
+    }
+    return ret;
 }
 
 /**
  * @fn flash_read
  *
- * @brief Read content from file
+ * @brief Read content from file at desired offset
  * @param  fd [IN] - File descriptor of file to read from
  * @param  buf [OUT] - Buffer contains read data
  * @param  count [IN] - Size to read in bytes
+ * @param  offset [IN] - Location in file to read
  * @return  0 - Success
  *         -1 - Failure
  **/
-static int flash_read(int fd, void *buf, size_t count)
+static int flash_read(int fd, void *buf, size_t count, unsigned long offset)
 {
-    size_t result;
+    ssize_t result;
     int ret = 0;
 
-    result = read(fd, buf, count);
+    result = pread(fd, buf, count, (off_t) offset);
 
-    if (count != result) {
-        if ((signed)result < 0) {
+    if ((ssize_t) count != result) {
+        if (result < 0) {
             log_printf(LOG_ERROR, "Error while reading data: %m\n");
             ret = -1;
         }
@@ -125,85 +198,68 @@ static int flash_read(int fd, void *buf, size_t count)
     return ret;
 }
 
-/**
- * @fn flash_rewind
- *
- * @brief Rewind pointer to specified offset
- * @param  fd [IN] - File descriptor of file to seek
- * @param  offset [IN] - Desired location in file
- * @return  0 - Success
- *         -1 - Failure
- **/
-static int flash_rewind(int fd, unsigned long offset)
-{
-    if (lseek(fd, offset, SEEK_SET) < 0) {
-        log_printf(LOG_ERROR, "Error while seeking to %ld: %m\n", offset);
-        return -1;
-    }
-    return 0;
-}
-
 /**
  * @fn flash_write
  *
- * @brief Write content of buffer to flash at desired offset
- * @param  fd [IN] - File descriptor of flash
+ * @brief Write content of buffer to flash at desired offset. The data is
+ *        written straight from buffer, in chunks split on write page
+ *        boundaries of the MTD device.
+ * @param  ctx [IN] - The spinorfs context of the flash
  * @param  buffer [IN] - Data to be writen to flash
  * @param  buf_size [IN] - Data size
  * @param  offset [IN] - Location in flash to write
  * @return  0 - Success
  *         -1 - Failure
  **/
-static int flash_write(int fd, const void *buffer, size_t buf_size,
-                       unsigned long offset)
+static int flash_write(spinorfs_ctx_t *ctx, const void *buffer,
+                       size_t buf_size, unsigned long offset)
 {
-    ssize_t result, size, written;
-    unsigned char src[BUFSIZE];
-    int i, tmp = 0;
+    ssize_t result;
+    size_t size, written, page, max_chunk, i;
     int ret = 0;
-    unsigned char *buff = (unsigned char *)buffer;
+    const unsigned char *buff = (const unsigned char *)buffer;
 
     size = buf_size;
-    i = BUFSIZE;
     written = 0;
+    page = ctx->mtd.writesize ? ctx->mtd.writesize : 1;
+    /* Whole pages per write, at least one page */
+    max_chunk = (BUFSIZE / page) * page;
+    if (max_chunk == 0) {
+        max_chunk = page;
+    }
 
     log_printf(LOG_DEBUG, "Writing data: 0k/%luk (0%%)",
         KB(size));
 
-    tmp = flash_rewind(fd, offset);
-    if (tmp < 0) {
-        ret = -1;
-        goto out;
-    }
-
     /* Writing file content into flash */
     while (size) {
-        if (size < BUFSIZE)
+        /* Complete the first page, then keep the chunks page aligned */
+        i = max_chunk - (offset + written) % page;
+        if (size < i)
             i = size;
 
-        log_printf(LOG_DEBUG, "\rWriting data: %dk/%luk (%lu%%)",
+        log_printf(LOG_DEBUG, "\rWriting data: %luk/%luk (%lu%%)",
             KB(written + i), KB(buf_size),
             PERCENTAGE(written + i, buf_size));
 
-        /* read from filename */
-        memcpy((void*) src, buffer, i);
-
         /* write to device */
-        result = write(fd, src, i);
-        if (i != result) {
+        result = pwrite(ctx->dev_fd, buff, i, (off_t) (offset + written));
+        if ((ssize_t) i != result) {
             printf("\n");
             if (result < 0) {
                 log_printf(LOG_ERROR, "Error while writing data to"
-                    "0x%.8x-0x%.8x\n",
-                    written, written + i);
+                    " 0x%.8lx-0x%.8lx: %m\n",
+                    offset + written, offset + written + i);
                 ret = -1;
                 goto out;
             }
 
             log_printf(LOG_ERROR, "Short write count returned while"
-                "writing to x%.8x-0x%.8x: %d/%lu bytes"
-                " written to flash\n", written, written + i,
-                written + result, buf_size);
+                " writing to 0x%.8lx-0x%.8lx: %lu/%lu bytes"
+                " written to flash\n", offset + written,
+                offset + written + i,
+                (unsigned long) (written + result),
+                (unsigned long) buf_size);
             ret = -1;
             goto out;
         }
@@ -221,6 +277,104 @@ out:
 }
 
 
+/**
+ * @fn flash_cached_block
+ *
+ * @brief Get an erase block from the cache, reading the whole block from
+ *        the flash on a miss
+ * @param  ctx [IN/OUT] - The spinorfs context of the flash
+ * @param  offset [IN] - Flash offset of the erase block
+ * @param  data [OUT] - Content of the block
+ * @return  0 - Success
+ *          Others - Failure
+ **/
+static int flash_cached_block(spinorfs_ctx_t *ctx, unsigned long offset,
+                              uint8_t **data)
+{
+    *data = blk_cache_lookup(&ctx->cache, offset);
+    if (*data != NULL) {
+        return LFS_ERR_OK;
+    }
+    *data = blk_cache_insert(&ctx->cache, offset);
+    if (*data == NULL) {
+        return LFS_ERR_NOMEM;
+    }
+    if (flash_read(ctx->dev_fd, *data, (size_t) ctx->mtd.erasesize,
+                   offset) < 0) {
+        blk_cache_invalidate(&ctx->cache, offset);
+        *data = NULL;
+        return LFS_ERR_IO;
+    }
+    return LFS_ERR_OK;
+}
+
+/**
+ * @fn flash_is_blank
+ *
+ * @brief Check that the data reads as erased flash (all bytes 0xFF)
+ * @param  data [IN] - Data to check, 8 bytes aligned
+ * @param  size [IN] - Size of data in bytes
+ * @return  1 - Blank
+ *          0 - Not blank
+ **/
+static int flash_is_blank(const uint8_t *data, size_t size)
+{
+    const uint64_t *word = (const uint64_t *) data;
+    size_t words = size / sizeof(*word);
+    size_t i = 0;
+    uint64_t acc = UINT64_MAX;
+
+    /* AND whole words in chunks the compiler can vectorize */
+    for (i = 0; i < words; i++) {
+        acc &= word[i];
+        if ((i & 7) == 7 && acc != UINT64_MAX) {
+            return 0;
+        }
+    }
+    if (acc != UINT64_MAX) {
+        return 0;
+    }
+    for (i *= sizeof(*word); i < size; i++) {
+        if (data[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @fn flash_block_blank
+ *
+ * @brief Check whether an erase block is already erased
+ * @param  ctx [IN/OUT] - The spinorfs context of the flash
+ * @param  offset [IN] - Flash offset of the erase block
+ * @return  1 - Blank
+ *          0 - Not blank or the block can't be read
+ **/
+static int flash_block_blank(spinorfs_ctx_t *ctx, unsigned long offset)
+{
+    uint8_t *data = NULL;
+    int blank = 0;
+
+    if (ctx->cache.capacity) {
+        if (flash_cached_block(ctx, offset, &data) == LFS_ERR_OK) {
+            blank = flash_is_blank(data, ctx->mtd.erasesize);
+        }
+        return blank;
+    }
+
+    data = (uint8_t *)malloc(ctx->mtd.erasesize);
+    if (data == NULL) {
+        return 0;
+    }
+    if (flash_read(ctx->dev_fd, data, (size_t) ctx->mtd.erasesize,
+                   offset) == 0) {
+        blank = flash_is_blank(data, ctx->mtd.erasesize);
+    }
+    free(data);
+    return blank;
+}
+
 /**
  * @fn flash_read_lfs
  *
@@ -236,12 +390,12 @@ out:
 static int flash_read_lfs(const struct lfs_config *c, lfs_block_t block,
                    lfs_off_t off, void *buffer, lfs_size_t size)
 {
+    spinorfs_ctx_t *ctx = (spinorfs_ctx_t *) c->context;
     int ret = LFS_ERR_OK;
-    lfs_size_t block_count = (lfs_size_t) mtd.size / mtd.erasesize;
-    lfs_size_t block_size = (lfs_size_t) mtd.erasesize;
-    unsigned long offset = lfs_offset;
-
-    UN_USED(c);
+    lfs_size_t block_count = (lfs_size_t) ctx->mtd.size / ctx->mtd.erasesize;
+    lfs_size_t block_size = (lfs_size_t) ctx->mtd.erasesize;
+    unsigned long offset = ctx->offset;
+    uint8_t *data = NULL;
 
     log_printf(LOG_DEBUG, "[flash_read_lfs] block:%d, size:%d, off:%d.\n",
                block, size, off);
@@ -251,22 +405,95 @@ static int flash_read_lfs(const struct lfs_config *c, lfs_block_t block,
         goto exit;
     }
     /* Calculate offset */
-    offset = (unsigned long) block * block_size + off + lfs_offset;
-    if (flash_rewind(dev_fd, offset) < 0) {
-        log_printf(LOG_ERROR, "While seeking to offset: 0X%08x\n", offset);
-        ret = LFS_ERR_IO;
+    offset = (unsigned long) block * block_size + ctx->offset;
+    if (ctx->cache.capacity == 0) {
+        if (flash_read(ctx->dev_fd, buffer, (size_t) size,
+                       offset + off) < 0) {
+            ret = LFS_ERR_IO;
+        }
         goto exit;
     }
 
-    if (flash_read(dev_fd, buffer, (size_t) size) < 0) {
-        ret = LFS_ERR_IO;
+    /* Serve the read from the cache, fill the whole block on a miss */
+    ret = flash_cached_block(ctx, offset, &data);
+    if (ret != LFS_ERR_OK) {
         goto exit;
     }
+    memcpy(buffer, data + off, size);
 
 exit:
     return ret;
 }
 
+/**
+ * @fn flash_write_changed
+ *
+ * @brief Program only the pages whose content differs from the flash.
+ *        A differing page is always programmed, so a page needing a 0 to 1
+ *        transition is never skipped.
+ * @param  ctx [IN/OUT] - The spinorfs context of the flash
+ * @param  block_offset [IN] - Flash offset of the erase block
+ * @param  off [IN] - Offset in the block, aligned on prog_size
+ * @param  buffer [IN] - Data to program
+ * @param  size [IN] - Size of data in bytes
+ * @return  0 - Success
+ *         -1 - Failure
+ **/
+static int flash_write_changed(spinorfs_ctx_t *ctx,
+                               unsigned long block_offset, lfs_off_t off,
+                               const uint8_t *buffer, lfs_size_t size)
+{
+    const uint8_t *cur = NULL;
+    uint8_t *tmp = NULL;
+    lfs_size_t page = ctx->cfg.prog_size;
+    lfs_size_t start = 0, end = 0, len = 0;
+    int ret = 0;
+
+    /* Current content from the cache, or read the target range */
+    cur = blk_cache_lookup(&ctx->cache, block_offset);
+    if (cur != NULL) {
+        cur += off;
+    } else {
+        tmp = (uint8_t *)malloc(size);
+        if (tmp != NULL &&
+            flash_read(ctx->dev_fd, tmp, (size_t) size,
+                       block_offset + off) == 0) {
+            cur = tmp;
+        }
+    }
+
+    /*
+     * Program each run of differing pages with one write. The cached data
+     * is only marked invalid, so cur stays readable for the later pages,
+     * which are not programmed yet.
+     */
+    for (start = 0; start < size; start = end) {
+        end = start;
+        while (end < size) {
+            len = (size - end < page) ? size - end : page;
+            if (cur != NULL && memcmp(cur + end, buffer + end, len) == 0) {
+                break;
+            }
+            end += len;
+            ctx->pages_programmed++;
+        }
+        if (end > start) {
+            blk_cache_invalidate(&ctx->cache, block_offset);
+            if (flash_write(ctx, buffer + start, (size_t) (end - start),
+                            block_offset + off + start) < 0) {
+                ret = -1;
+                break;
+            }
+        } else {
+            end += len;
+            ctx->pages_skipped++;
+        }
+    }
+
+    free(tmp);
+    return ret;
+}
+
 /**
  * @fn flash_write_lfs
  *
@@ -282,25 +509,37 @@ exit:
 static int flash_write_lfs(const struct lfs_config *c, lfs_block_t block,
                     lfs_off_t off, const void *buffer, lfs_size_t size)
 {
+    spinorfs_ctx_t *ctx = (spinorfs_ctx_t *) c->context;
     int ret = LFS_ERR_OK;
-    lfs_size_t block_count = (lfs_size_t) mtd.size / mtd.erasesize;
-    lfs_size_t block_size = (lfs_size_t) mtd.erasesize;
-    unsigned long offset = lfs_offset;
-
-    UN_USED(c);
+    lfs_size_t block_count = (lfs_size_t) ctx->mtd.size / ctx->mtd.erasesize;
+    lfs_size_t block_size = (lfs_size_t) ctx->mtd.erasesize;
+    unsigned long offset = ctx->offset;
 
     log_printf(LOG_DEBUG, "[flash_write_lfs] block:%d, size:%d, off:%d.\n",
                block, size, off);
 
+    if (ctx->read_only) {
+        log_printf(LOG_ERROR, "Program on a read-only mount\n");
+        ret = LFS_ERR_IO;
+        goto exit;
+    }
     if (block > block_count) {
         ret = LFS_ERR_INVAL;
         goto exit;
     }
 
     /* Calculate offset */
-    offset = (unsigned long) block * block_size + off + lfs_offset;
-    if (flash_write(dev_fd, buffer, (size_t) size,
-        (unsigned long) offset) < 0) {
+    offset = (unsigned long) block * block_size + ctx->offset;
+    if (ctx->compare_write) {
+        if (flash_write_changed(ctx, offset, off, buffer, size) < 0) {
+            ret = LFS_ERR_IO;
+        }
+        goto exit;
+    }
+    blk_cache_invalidate(&ctx->cache, offset);
+    ctx->pages_programmed += (size + c->prog_size - 1) / c->prog_size;
+    if (flash_write(ctx, buffer, (size_t) size,
+        (unsigned long) offset + off) < 0) {
         ret = LFS_ERR_IO;
     }
 
@@ -319,22 +558,35 @@ exit:
  **/
 static int flash_erase_lfs(const struct lfs_config *c, lfs_block_t block)
 {
+    spinorfs_ctx_t *ctx = (spinorfs_ctx_t *) c->context;
     int ret = LFS_ERR_OK;
-    lfs_size_t block_count = (lfs_size_t) mtd.size / mtd.erasesize;
-    lfs_size_t block_size = (lfs_size_t) mtd.erasesize;
-    unsigned long offset = lfs_offset;
-
-    UN_USED(c);
+    lfs_size_t block_count = (lfs_size_t) ctx->mtd.size / ctx->mtd.erasesize;
+    lfs_size_t block_size = (lfs_size_t) ctx->mtd.erasesize;
+    unsigned long offset = ctx->offset;
 
     log_printf(LOG_DEBUG, "[flash_erase_lfs] block:%d.\n", block);
 
+    if (ctx->read_only) {
+        log_printf(LOG_ERROR, "Erase on a read-only mount\n");
+        ret = LFS_ERR_IO;
+        goto exit;
+    }
     if (block > block_count) {
         ret = LFS_ERR_INVAL;
         goto exit;
     }
     /* Calculate offset */
-    offset = (unsigned long) block * block_size + lfs_offset;
-    if (flash_erase(dev_fd, offset, block_size) < 0) {
+    offset = (unsigned long) block * block_size + ctx->offset;
+    /* A sector erase takes far longer than reading the block back */
+    if (ctx->blank_check && flash_block_blank(ctx, offset)) {
+        log_printf(LOG_DEBUG, "[flash_erase_lfs] block:%d already blank.\n",
+                   block);
+        ctx->erase_skipped++;
+        goto exit;
+    }
+    blk_cache_invalidate(&ctx->cache, offset);
+    ctx->erase_count++;
+    if (flash_erase(ctx, offset, block_size) < 0) {
         ret = LFS_ERR_IO;
     }
 exit:
@@ -365,152 +617,715 @@ static int flash_sync_lfs(const struct lfs_config *c )
 
 
 /**
- * @fn spinorfs_mount
+ * @fn lfs_buffers_free
  *
- * @brief Mount a partition as LittleFS filesystem
- * @param  mtd_fd [IN] - MTD device file descriptor info
- * @param  size [IN]   - Size of the partition
- * @param  offset [IN] - The location of partition in the flash
+ * @brief Release the littlefs buffers allocated at mount
+ * @param  ctx [IN/OUT] - The spinorfs context
+ **/
+static void lfs_buffers_free(spinorfs_ctx_t *ctx)
+{
+    free(ctx->read_buf);
+    free(ctx->prog_buf);
+    free(ctx->lookahead_buf);
+    ctx->read_buf = NULL;
+    ctx->prog_buf = NULL;
+    ctx->lookahead_buf = NULL;
+}
+
+/**
+ * @fn lfs_geometry
+ *
+ * @brief Select the littlefs I/O and cache sizes from the MTD device and
+ *        the partition size, then apply the mount options.
+ * @param  ctx [IN/OUT] - The spinorfs context, its lfs config is updated
+ * @param  opts [IN] - Mount options, NULL to use the derived sizes only
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_mount(int mtd_fd, uint32_t size, uint32_t offset)
+static int lfs_geometry(spinorfs_ctx_t *ctx,
+                        const struct spinorfs_mount_opts *opts)
 {
-    int ret = EXIT_SUCCESS;
-    int err = -1;
+    struct lfs_config *cfg = &ctx->cfg;
+    lfs_size_t page = DEFAULT_READ_PRO_SIZE;
+    lfs_size_t align = LFS_LOOKAHEAD_ALIGN * CHAR_BIT;
 
+    /* SPI-NOR reports a write size of 1, keep the host firmware's minimum */
+    if (ctx->mtd.writesize > page) {
+        page = (lfs_size_t) ctx->mtd.writesize;
+    }
+    cfg->read_size = page;
+    cfg->prog_size = page;
+    /*
+     * littlefs inlines files up to the cache size. Keep the host firmware's
+     * cache size so it can read the files nvparm writes, a larger cache is
+     * only used through spinorfs_mount_opts.
+     */
+    cfg->cache_size = page;
+    /* Track all blocks of the partition in one allocator scan */
+    cfg->lookahead_size = (cfg->block_count + align - 1) / align *
+                          LFS_LOOKAHEAD_ALIGN;
+
+    if (opts != NULL) {
+        if (opts->read_size) {
+            cfg->read_size = opts->read_size;
+        }
+        if (opts->prog_size) {
+            cfg->prog_size = opts->prog_size;
+        }
+        if (opts->cache_size) {
+            cfg->cache_size = opts->cache_size;
+        }
+        if (opts->lookahead_size) {
+            cfg->lookahead_size = opts->lookahead_size;
+        }
+    }
+
+    if (cfg->read_size == 0 || cfg->prog_size == 0 ||
+        cfg->cache_size == 0 || cfg->block_size == 0 ||
+        cfg->cache_size % cfg->read_size ||
+        cfg->cache_size % cfg->prog_size ||
+        cfg->block_size % cfg->cache_size ||
+        cfg->lookahead_size == 0 ||
+        cfg->lookahead_size % LFS_LOOKAHEAD_ALIGN) {
+        log_printf(LOG_ERROR, "Invalid LFS geometry: read %u, prog %u,"
+                   " cache %u, block %u, lookahead %u\n",
+                   cfg->read_size, cfg->prog_size,
+                   cfg->cache_size, cfg->block_size,
+                   cfg->lookahead_size);
+        return EXIT_FAILURE;
+    }
+    log_printf(LOG_DEBUG, "LFS geometry: read %u, prog %u, cache %u,"
+               " block %u x %u, lookahead %u\n",
+               cfg->read_size, cfg->prog_size,
+               cfg->cache_size, cfg->block_size,
+               cfg->block_count, cfg->lookahead_size);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn spinorfs_ctx_attach
+ *
+ * @brief Bind a context to an MTD device and read the device geometry
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  mtd_fd [IN] - MTD device file descriptor info
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int spinorfs_ctx_attach(spinorfs_ctx_t *ctx, int mtd_fd)
+{
     if (mtd_fd == -1) {
         log_printf(LOG_ERROR,"Invalid MTD description file info.\n");
         return EXIT_FAILURE;
     }
 
     /* Get the MTD device info */
-    ret = ioctl(mtd_fd, MEMGETINFO, &mtd);
-    if (ret < 0) {
+    if (ioctl(mtd_fd, MEMGETINFO, &ctx->mtd) < 0) {
         log_printf(LOG_ERROR,"Can't read MTD device info.\n");
         return EXIT_FAILURE;
     }
-    dev_fd = mtd_fd;
+    ctx->dev_fd = mtd_fd;
+    return EXIT_SUCCESS;
+}
 
-    lfs_part_size = (lfs_size_t) size;
-    lfs_offset = (lfs_size_t) offset;
+/**
+ * @fn spinorfs_ctx_create
+ *
+ * @brief Create a context owning the state of an MTD device: its geometry,
+ *        partition table, mounted partition, buffers, cache and open file.
+ *        Contexts are independent, each one can be used from its own thread.
+ * @param  mtd_fd [IN] - MTD device file descriptor info, closed by the caller
+ *                       after spinorfs_ctx_destroy
+ * @return  The context, or NULL on failure
+ **/
+spinorfs_ctx_t *spinorfs_ctx_create(int mtd_fd)
+{
+    spinorfs_ctx_t *ctx = NULL;
+
+    ctx = (spinorfs_ctx_t *)calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        log_printf(LOG_ERROR, "Cannot allocate memory\n");
+        return NULL;
+    }
+    ctx->dev_fd = -1;
+    ctx->cache_blocks = DEFAULT_CACHE_BLOCKS;
+    ctx->blank_check = DEFAULT_BLANK_CHECK;
+    ctx->compare_write = DEFAULT_COMPARE_WRITE;
+    if (spinorfs_ctx_attach(ctx, mtd_fd) != EXIT_SUCCESS) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/**
+ * @fn spinorfs_ctx_destroy
+ *
+ * @brief Close the open files, unmount the partition and free the context
+ * @param  ctx [IN] - The spinorfs context, may be NULL
+ **/
+void spinorfs_ctx_destroy(spinorfs_ctx_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->mounted) {
+        spinorfs_ctx_unmount(ctx);
+    }
+    lfs_buffers_free(ctx);
+    blk_cache_release(&ctx->cache);
+    free(ctx);
+}
+
+/**
+ * @fn spinorfs_ctx_gpt_disk_info
+ *
+ * @brief Parse GPT info of the context's device
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  show_gpt [IN] - Show the GPT info into console
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_gpt_disk_info(spinorfs_ctx_t *ctx, int show_gpt)
+{
+    return gpt_disk_info(&ctx->gpt, ctx->dev_fd, show_gpt);
+}
+
+/**
+ * @fn spinorfs_ctx_gpt_find_guid
+ *
+ * @brief Get offset and size of the partition via GUID, reading the GPT
+ *        only up to the matching entry
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_gpt_find_guid(spinorfs_ctx_t *ctx, uint8_t *guid,
+                               uint32_t *offset, uint32_t *size)
+{
+    return gpt_find_guid(&ctx->gpt, ctx->dev_fd, guid, offset, size);
+}
+
+/**
+ * @fn spinorfs_ctx_gpt_find_name
+ *
+ * @brief Get offset and size of the partition via partition name, reading
+ *        the GPT only up to the matching entry
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_gpt_find_name(spinorfs_ctx_t *ctx, char *part,
+                               uint32_t *offset, uint32_t *size)
+{
+    return gpt_find_name(&ctx->gpt, ctx->dev_fd, part, offset, size);
+}
+
+/**
+ * @fn spinorfs_ctx_gpt_part_guid_info
+ *
+ * @brief Get offset and size of the partition via GUID from the partition
+ *        table parsed by spinorfs_ctx_gpt_disk_info
+ * @param  ctx [IN] - The spinorfs context
+ * @param  guid [IN] - Partition GUID number
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_gpt_part_guid_info(spinorfs_ctx_t *ctx, uint8_t *guid,
+                                    uint32_t *offset, uint32_t *size)
+{
+    return gpt_part_guid_info(&ctx->gpt, guid, offset, size);
+}
+
+/**
+ * @fn spinorfs_ctx_gpt_part_name_info
+ *
+ * @brief Get offset and size of the partition via partition name from the
+ *        partition table parsed by spinorfs_ctx_gpt_disk_info
+ * @param  ctx [IN] - The spinorfs context
+ * @param  part [IN] - Partition name
+ * @param  offset [OUT] - The partition offset at the flash
+ * @param  size [OUT] - The partition size in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_gpt_part_name_info(spinorfs_ctx_t *ctx, char *part,
+                                    uint32_t *offset, uint32_t *size)
+{
+    return gpt_part_name_info(&ctx->gpt, part, offset, size);
+}
+
+/**
+ * @fn spinorfs_ctx_gpt_get_crc
+ *
+ * @brief Get the CRCs of the last GPT verified for the context's device
+ * @param  ctx [IN] - The spinorfs context
+ * @param  crc [OUT] - CRCs and LBA of the verified GPT header
+ * @return  0 - Success
+ *          1 - Failure, no GPT verified yet
+ **/
+int spinorfs_ctx_gpt_get_crc(spinorfs_ctx_t *ctx,
+                             struct spinorfs_gpt_crc *crc)
+{
+    return gpt_get_crc(&ctx->gpt, crc);
+}
+
+/**
+ * @fn spinorfs_ctx_mount
+ *
+ * @brief Mount a partition of the context's device as LittleFS filesystem.
+ *        The littlefs sizes are derived from the MTD device unless set in
+ *        opts. A partition that can't be mounted is formatted, unless it is
+ *        mounted read-only.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  size [IN]   - Size of the partition
+ * @param  offset [IN] - The location of partition in the flash
+ * @param  opts [IN]   - Mount options, NULL for the derived sizes
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_mount(spinorfs_ctx_t *ctx, uint32_t size, uint32_t offset,
+                       const struct spinorfs_mount_opts *opts)
+{
+    int ret = EXIT_SUCCESS;
+    struct lfs_config *cfg = &ctx->cfg;
+
+    if (ctx->mounted) {
+        log_printf(LOG_ERROR, "A partition is already mounted\n");
+        return EXIT_FAILURE;
+    }
+
+    ctx->part_size = (lfs_size_t) size;
+    ctx->offset = (lfs_size_t) offset;
+    ctx->read_only = (opts != NULL && opts->read_only) ? 1 : 0;
 
     // configuration of the filesystem is provided by this struct
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->context = ctx;
     // block device operations
-    cfg_flash.read = flash_read_lfs;
-    cfg_flash.prog  = flash_write_lfs;
-    cfg_flash.erase = flash_erase_lfs;
-    cfg_flash.sync  = flash_sync_lfs;
+    cfg->read = flash_read_lfs;
+    cfg->prog  = flash_write_lfs;
+    cfg->erase = flash_erase_lfs;
+    cfg->sync  = flash_sync_lfs;
     // block device configuration
-    cfg_flash.read_size = DEFAULT_READ_PRO_SIZE; // SPI-NOR Page size
-    cfg_flash.prog_size = DEFAULT_READ_PRO_SIZE; // SPI-NOR Page size
-    cfg_flash.block_size = (lfs_size_t) mtd.erasesize;
-    cfg_flash.block_count = (lfs_size_t) (lfs_part_size / mtd.erasesize);
-    cfg_flash.cache_size = DEFAULT_READ_PRO_SIZE; // Equal to read/pro size
-    cfg_flash.lookahead_size = DEFAULT_LFS_LOOKAHEAD_SIZE;
-    cfg_flash.block_cycles = DEFAULT_LFS_BLOCK_CYCLE;
-    cfg_flash.read_buffer = lfs_read_buf;
-    cfg_flash.prog_buffer = lfs_prog_buf;
-    cfg_flash.lookahead_buffer = lfs_lookahead_buf;
-
-    err = lfs_mount(&lfs_flash, &cfg_flash);
-    if (err) {
+    cfg->block_size = (lfs_size_t) ctx->mtd.erasesize;
+    cfg->block_count = (lfs_size_t) (ctx->part_size / ctx->mtd.erasesize);
+    cfg->block_cycles = DEFAULT_LFS_BLOCK_CYCLE;
+    if (lfs_geometry(ctx, opts) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    lfs_buffers_free(ctx);
+    ctx->read_buf = (uint8_t *)malloc(cfg->cache_size);
+    ctx->prog_buf = (uint8_t *)malloc(cfg->cache_size);
+    ctx->lookahead_buf = (uint8_t *)malloc(cfg->lookahead_size);
+    if (ctx->read_buf == NULL || ctx->prog_buf == NULL ||
+        ctx->lookahead_buf == NULL) {
+        log_printf(LOG_ERROR, "Can't allocate LFS buffers\n");
+        lfs_buffers_free(ctx);
+        return EXIT_FAILURE;
+    }
+    cfg->read_buffer = ctx->read_buf;
+    cfg->prog_buffer = ctx->prog_buf;
+    cfg->lookahead_buffer = ctx->lookahead_buf;
+
+    if (blk_cache_init(&ctx->cache, ctx->cache_blocks, ctx->mtd.erasesize)) {
+        lfs_buffers_free(ctx);
+        return EXIT_FAILURE;
+    }
+
+    if (lfs_mount(&ctx->lfs, cfg)) {
+        /* Formatting would erase the partition, fail fast instead */
+        if (ctx->read_only) {
+            log_printf(LOG_ERROR, "Cannot mount device read-only\n");
+            blk_cache_release(&ctx->cache);
+            lfs_buffers_free(ctx);
+            return EXIT_FAILURE;
+        }
         log_printf(LOG_NORMAL,"Mount failed. Format then retry mount..\n");
-        lfs_format(&lfs_flash, &cfg_flash);
-        if (lfs_mount(&lfs_flash, &cfg_flash)) {
+        lfs_format(&ctx->lfs, cfg);
+        if (lfs_mount(&ctx->lfs, cfg)) {
             log_printf(LOG_ERROR,"Cannot mount device!!! Going to exit...\n");
             ret = EXIT_FAILURE;
-            dev_fd = -1;
+            blk_cache_release(&ctx->cache);
+            lfs_buffers_free(ctx);
         }
     }
+    ctx->mounted = (ret == EXIT_SUCCESS);
 
     return ret;
 }
 
 /**
- * @fn spinorfs_unmount
+ * @fn spinorfs_ctx_unmount
  *
- * @brief Release any resources we were using
+ * @brief Close the files still open, unmount the partition of the context
+ *        and release its buffers
+ * @param  ctx [IN/OUT] - The spinorfs context
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_unmount(void)
+int spinorfs_ctx_unmount(spinorfs_ctx_t *ctx)
 {
     int ret = EXIT_SUCCESS;
 
-    ret = lfs_unmount(&lfs_flash);
+    if (!ctx->mounted) {
+        log_printf(LOG_ERROR, "No partition mounted\n");
+        return EXIT_FAILURE;
+    }
+    while (ctx->files != NULL) {
+        log_printf(LOG_DEBUG, "Close a file left open at unmount\n");
+        spinorfs_close(ctx->files);
+    }
+    ret = lfs_unmount(&ctx->lfs);
     if (ret != 0) {
         log_printf(LOG_ERROR, "ERROR in unmount LFS\n");
         ret = EXIT_FAILURE;
     } else {
-        dev_fd = -1;
-        memset(&cfg_flash, 0, sizeof(cfg_flash));
-        memset(&lfs_flash, 0, sizeof(lfs_flash));
+        ctx->mounted = 0;
+        memset(&ctx->cfg, 0, sizeof(ctx->cfg));
+        memset(&ctx->lfs, 0, sizeof(ctx->lfs));
+        lfs_buffers_free(ctx);
     }
+    log_printf(LOG_DEBUG, "Block cache: %llu hits, %llu misses\n",
+               (unsigned long long) ctx->cache.hits,
+               (unsigned long long) ctx->cache.misses);
+    log_printf(LOG_DEBUG, "Erases: %llu done, %llu skipped, %llu ioctls,"
+               " %llu us\n",
+               (unsigned long long) ctx->erase_count,
+               (unsigned long long) ctx->erase_skipped,
+               (unsigned long long) ctx->erase_ioctls,
+               (unsigned long long) ctx->erase_time_us);
+    log_printf(LOG_DEBUG, "Pages: %llu programmed, %llu skipped\n",
+               (unsigned long long) ctx->pages_programmed,
+               (unsigned long long) ctx->pages_skipped);
+    blk_cache_release(&ctx->cache);
     return ret;
 }
 
+/**
+ * @fn spinorfs_ctx_set_cache_size
+ *
+ * @brief Set the number of erase blocks cached for reads. It applies from
+ *        the next mount.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  blocks [IN] - Number of erase blocks, 0 disables the cache
+ **/
+void spinorfs_ctx_set_cache_size(spinorfs_ctx_t *ctx, uint32_t blocks)
+{
+    ctx->cache_blocks = blocks;
+}
+
+/**
+ * @fn spinorfs_ctx_set_blank_check
+ *
+ * @brief Enable or disable skipping the erase of blocks already blank
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  enable [IN] - 1 to read the block before erasing it, 0 to always
+ *                       erase
+ **/
+void spinorfs_ctx_set_blank_check(spinorfs_ctx_t *ctx, int enable)
+{
+    ctx->blank_check = enable ? 1 : 0;
+}
+
+/**
+ * @fn spinorfs_ctx_set_compare_write
+ *
+ * @brief Enable or disable skipping the program of pages already holding
+ *        the data
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  enable [IN] - 1 to compare with the flash before programming,
+ *                       0 to always program
+ **/
+void spinorfs_ctx_set_compare_write(spinorfs_ctx_t *ctx, int enable)
+{
+    ctx->compare_write = enable ? 1 : 0;
+}
+
+/**
+ * @fn spinorfs_ctx_get_stats
+ *
+ * @brief Get the statistics of the flash accesses of the context since the
+ *        last reset
+ * @param  ctx [IN] - The spinorfs context
+ * @param  stats [OUT] - Statistics
+ **/
+void spinorfs_ctx_get_stats(spinorfs_ctx_t *ctx,
+                            struct spinorfs_stats *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->cache_hits = ctx->cache.hits;
+    stats->cache_misses = ctx->cache.misses;
+    stats->erases = ctx->erase_count;
+    stats->erases_skipped = ctx->erase_skipped;
+    stats->erase_ioctls = ctx->erase_ioctls;
+    stats->erase_time_us = ctx->erase_time_us;
+    stats->pages_programmed = ctx->pages_programmed;
+    stats->pages_skipped = ctx->pages_skipped;
+}
+
+/**
+ * @fn spinorfs_ctx_reset_stats
+ *
+ * @brief Reset the statistics of the flash accesses of the context
+ * @param  ctx [IN/OUT] - The spinorfs context
+ **/
+void spinorfs_ctx_reset_stats(spinorfs_ctx_t *ctx)
+{
+    ctx->cache.hits = 0;
+    ctx->cache.misses = 0;
+    ctx->erase_count = 0;
+    ctx->erase_skipped = 0;
+    ctx->erase_ioctls = 0;
+    ctx->erase_time_us = 0;
+    ctx->pages_programmed = 0;
+    ctx->pages_skipped = 0;
+}
+
+/**
+ * @fn spinorfs_ctx_open
+ *
+ * @brief Open file of the mounted partition with specified mode. Several
+ *        files can be open at once, each one with its own position. Only
+ *        SPINORFS_O_RDONLY is allowed on a read-only mount.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  file [IN] - File to be opened
+ * @param  flags [IN] - Access mode to file
+ * @return  The file handle, or NULL on failure
+ **/
+spinorfs_file_t *spinorfs_ctx_open(spinorfs_ctx_t *ctx, char *file,
+                                   int flags)
+{
+    int ret = EXIT_SUCCESS;
+    spinorfs_file_t *fp = NULL;
+
+    if (file == NULL || !ctx->mounted) {
+        return NULL;
+    }
+    if (ctx->read_only && flags != SPINORFS_O_RDONLY) {
+        log_printf(LOG_ERROR, "Read-only mount, cannot open %s to write\n",
+                   file);
+        return NULL;
+    }
+    fp = (spinorfs_file_t *)calloc(1, sizeof(*fp));
+    if (fp == NULL) {
+        log_printf(LOG_ERROR, "Cannot allocate memory\n");
+        return NULL;
+    }
+    ret = lfs_file_open(&ctx->lfs, &fp->file, file, flags);
+    if (ret < 0) {
+        log_printf(LOG_ERROR, "ERROR %d in open file %s\n", ret, file);
+        free(fp);
+        return NULL;
+    }
+    fp->ctx = ctx;
+    fp->pos = 0;
+    fp->append = (flags & SPINORFS_O_APPEND) ? 1 : 0;
+    fp->next = ctx->files;
+    ctx->files = fp;
+    return fp;
+}
+
 /**
  * @fn spinorfs_open
  *
  * @brief Open file with specified mode.
  * @param  file [IN] - File to be opened
  * @param  flags [IN] - Access mode to file
+ * @return  The file handle, or NULL on failure
+ **/
+spinorfs_file_t *spinorfs_open(char *file, int flags)
+{
+    return spinorfs_ctx_open(&default_ctx, file, flags);
+}
+
+/**
+ * @fn spinorfs_ctx_rename
+ *
+ * @brief Rename a file of the mounted partition, atomically replacing the
+ *        new file if it exists.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  old_file [IN] - File to be renamed
+ * @param  new_file [IN] - New name of the file
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_open(char *file, int flags)
+int spinorfs_ctx_rename(spinorfs_ctx_t *ctx, char *old_file, char *new_file)
 {
     int ret = EXIT_SUCCESS;
-    if (file == NULL) {
+
+    if (old_file == NULL || new_file == NULL || !ctx->mounted ||
+        ctx->read_only) {
         return EXIT_FAILURE;
     }
-    /* Open file as READ ONLY */
-    ret = lfs_file_open(&lfs_flash, &file_flash, file, flags);
+    ret = lfs_rename(&ctx->lfs, old_file, new_file);
     if (ret < 0) {
-        log_printf(LOG_ERROR, "ERROR %d in open file %s\n", ret, file);
+        log_printf(LOG_ERROR, "ERROR %d in rename file %s to %s\n", ret,
+                   old_file, new_file);
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
 /**
- * @fn spinorfs_open
+ * @fn spinorfs_rename
+ *
+ * @brief Rename a file, atomically replacing the new file if it exists.
+ * @param  old_file [IN] - File to be renamed
+ * @param  new_file [IN] - New name of the file
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_rename(char *old_file, char *new_file)
+{
+    return spinorfs_ctx_rename(&default_ctx, old_file, new_file);
+}
+
+/**
+ * @fn spinorfs_ctx_remove
+ *
+ * @brief Remove a file of the mounted partition.
+ * @param  ctx [IN/OUT] - The spinorfs context
+ * @param  file [IN] - File to be removed
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_ctx_remove(spinorfs_ctx_t *ctx, char *file)
+{
+    int ret = EXIT_SUCCESS;
+
+    if (file == NULL || !ctx->mounted || ctx->read_only) {
+        return EXIT_FAILURE;
+    }
+    ret = lfs_remove(&ctx->lfs, file);
+    if (ret < 0) {
+        log_printf(LOG_ERROR, "ERROR %d in remove file %s\n", ret, file);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn spinorfs_remove
+ *
+ * @brief Remove a file.
+ * @param  file [IN] - File to be removed
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_remove(char *file)
+{
+    return spinorfs_ctx_remove(&default_ctx, file);
+}
+
+/**
+ * @fn spinorfs_close
  *
- * @brief Close the opened file.
+ * @brief Close the opened file and release its handle.
  * Call this when finish operating on the opened file by spinorfs_open.
+ * @param  fp [IN] - File handle
  * @return  0 - Success
  *          1 - Failure
  **/
-int spinorfs_close()
+int spinorfs_close(spinorfs_file_t *fp)
 {
     int ret = EXIT_SUCCESS;
-    if (file_flash.cfg == NULL) {
+    spinorfs_file_t **link = NULL;
+
+    if (fp == NULL) {
         log_printf(LOG_ERROR, "Tried to close file without open before\n");
         return EXIT_FAILURE;
     }
 
-    /* Open file as READ ONLY */
-    ret = lfs_file_close(&lfs_flash, &file_flash);
+    ret = lfs_file_close(&fp->ctx->lfs, &fp->file);
     if (ret < 0) {
         log_printf(LOG_ERROR, "ERROR %d in close file\n", ret);
         ret = EXIT_FAILURE;
     }
-    memset(&file_flash, 0, sizeof(file_flash));
+    for (link = &fp->ctx->files; *link != NULL; link = &(*link)->next) {
+        if (*link == fp) {
+            *link = fp->next;
+            break;
+        }
+    }
+    free(fp);
     return ret;
 }
 
+/**
+ * @fn spinorfs_seek
+ *
+ * @brief Move the position of the file. littlefs is not called when the
+ *        file is already at offset.
+ * @param  fp [IN/OUT] - File handle
+ * @param  offset [IN] - File offset
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_seek(spinorfs_file_t *fp, uint32_t offset)
+{
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (fp->pos == (lfs_soff_t)offset) {
+        return EXIT_SUCCESS;
+    }
+    if (lfs_file_seek(&fp->ctx->lfs, &fp->file, offset, LFS_SEEK_SET) !=
+        (lfs_soff_t)offset) {
+        log_printf(LOG_ERROR, "ERROR in seek to offset: 0x%.8x\n", offset);
+        fp->pos = -1;
+        return EXIT_FAILURE;
+    }
+    fp->pos = (lfs_soff_t)offset;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn spinorfs_size
+ *
+ * @brief Get the size of the file.
+ * @param  fp [IN] - File handle
+ * @return  The size of the file in byte, or -1 on failure
+ **/
+int spinorfs_size(spinorfs_file_t *fp)
+{
+    lfs_soff_t size = 0;
+
+    if (fp == NULL) {
+        return -1;
+    }
+    size = lfs_file_size(&fp->ctx->lfs, &fp->file);
+    if (size < 0) {
+        log_printf(LOG_ERROR, "ERROR in get lfs file size: %d\n", size);
+        return -1;
+    }
+    return (int)size;
+}
+
 /**
  * @fn spinorfs_read
  *
  * @brief Read size bytes of file into buffer. File should be opened
  *        before reading.
+ * @param  fp [IN/OUT] - File handle
  * @param  buff [IN] - Target buffer stores the read file data
  * @param  offset [IN] - File offset
  * @param  size [IN] - Content size
  * @return  The number of bytes read, or -1 on failure
  **/
-int spinorfs_read(char *buff, uint32_t offset, uint32_t size)
+int spinorfs_read(spinorfs_file_t *fp, char *buff, uint32_t offset,
+                  uint32_t size)
 {
     lfs_ssize_t byte_cnt = 0;
 
@@ -518,18 +1333,19 @@ int spinorfs_read(char *buff, uint32_t offset, uint32_t size)
         return -1;
     }
 
-    /* Seek file to offset */
-    if (lfs_file_seek(&lfs_flash, &file_flash, offset, LFS_SEEK_SET) != (lfs_soff_t)offset) {
-        log_printf(LOG_ERROR, "ERROR in seek to offset: 0x%.8x\n", offset);
+    /* Seek file to offset, sequential reads are already there */
+    if (spinorfs_seek(fp, offset) != EXIT_SUCCESS) {
         return -1;
     }
 
-    byte_cnt = lfs_file_read(&lfs_flash, &file_flash, buff, size);
+    byte_cnt = lfs_file_read(&fp->ctx->lfs, &fp->file, buff, size);
 
     if (byte_cnt < 0) {
         log_printf(LOG_ERROR, "ERROR in read lfs file: %d\n", byte_cnt);
+        fp->pos = -1;
         return -1;
     }
+    fp->pos += byte_cnt;
     return (int)byte_cnt;
 }
 
@@ -537,31 +1353,143 @@ int spinorfs_read(char *buff, uint32_t offset, uint32_t size)
  * @fn spinorfs_write
  *
  * @brief Write data buffer into file.
+ * @param  fp [IN/OUT] - File handle
  * @param  buff [IN] - Target buffer stores the write file data
  * @param  offset [IN] - File offset
  * @param  size [IN] - Content size
  * @return  The number of bytes written, or -1 on failure
  **/
-int spinorfs_write(char *buff, uint32_t offset, uint32_t size)
+int spinorfs_write(spinorfs_file_t *fp, char *buff, uint32_t offset,
+                   uint32_t size)
 {
     lfs_ssize_t byte_cnt = 0;
 
     if (buff == NULL) {
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    /* Seek file to offset */
-    if (lfs_file_seek(&lfs_flash, &file_flash, offset, LFS_SEEK_SET) != (lfs_soff_t)offset) {
-        log_printf(LOG_ERROR, "ERROR in seek to offset: 0x%.8x\n", offset);
-        return EXIT_FAILURE;
+    /* Seek file to offset, sequential writes are already there */
+    if (spinorfs_seek(fp, offset) != EXIT_SUCCESS) {
+        return -1;
     }
 
-    byte_cnt = lfs_file_write(&lfs_flash, &file_flash, buff, size);
+    byte_cnt = lfs_file_write(&fp->ctx->lfs, &fp->file, buff, size);
 
     if (byte_cnt < 0) {
         log_printf(LOG_ERROR, "ERROR in write lfs file: %d\n", byte_cnt);
+        fp->pos = -1;
         return -1;
     }
+    /* An append write moves to the end of the file */
+    fp->pos = fp->append ? -1 : fp->pos + byte_cnt;
 
     return (int)byte_cnt;
+}
+
+/**
+ * @fn spinorfs_mount
+ *
+ * @brief Mount a partition as LittleFS filesystem
+ * @param  mtd_fd [IN] - MTD device file descriptor info
+ * @param  size [IN]   - Size of the partition
+ * @param  offset [IN] - The location of partition in the flash
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_mount(int mtd_fd, uint32_t size, uint32_t offset)
+{
+    return spinorfs_mount_with_opts(mtd_fd, size, offset, NULL);
+}
+
+/**
+ * @fn spinorfs_mount_with_opts
+ *
+ * @brief Mount a partition as LittleFS filesystem. The littlefs sizes are
+ *        derived from the MTD device unless set in opts.
+ * @param  mtd_fd [IN] - MTD device file descriptor info
+ * @param  size [IN]   - Size of the partition
+ * @param  offset [IN] - The location of partition in the flash
+ * @param  opts [IN]   - Mount options, NULL for the derived sizes
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_mount_with_opts(int mtd_fd, uint32_t size, uint32_t offset,
+                             const struct spinorfs_mount_opts *opts)
+{
+    /* The mounted device is kept, spinorfs_ctx_mount rejects the mount */
+    if (!default_ctx.mounted &&
+        spinorfs_ctx_attach(&default_ctx, mtd_fd) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return spinorfs_ctx_mount(&default_ctx, size, offset, opts);
+}
+
+/**
+ * @fn spinorfs_unmount
+ *
+ * @brief Release any resources we were using
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinorfs_unmount(void)
+{
+    return spinorfs_ctx_unmount(&default_ctx);
+}
+
+/**
+ * @fn spinorfs_set_cache_size
+ *
+ * @brief Set the number of erase blocks cached for reads. It applies from
+ *        the next mount.
+ * @param  blocks [IN] - Number of erase blocks, 0 disables the cache
+ **/
+void spinorfs_set_cache_size(uint32_t blocks)
+{
+    spinorfs_ctx_set_cache_size(&default_ctx, blocks);
+}
+
+/**
+ * @fn spinorfs_set_blank_check
+ *
+ * @brief Enable or disable skipping the erase of blocks already blank
+ * @param  enable [IN] - 1 to read the block before erasing it, 0 to always
+ *                       erase
+ **/
+void spinorfs_set_blank_check(int enable)
+{
+    spinorfs_ctx_set_blank_check(&default_ctx, enable);
+}
+
+/**
+ * @fn spinorfs_set_compare_write
+ *
+ * @brief Enable or disable skipping the program of pages already holding
+ *        the data
+ * @param  enable [IN] - 1 to compare with the flash before programming,
+ *                       0 to always program
+ **/
+void spinorfs_set_compare_write(int enable)
+{
+    spinorfs_ctx_set_compare_write(&default_ctx, enable);
+}
+
+/**
+ * @fn spinorfs_get_stats
+ *
+ * @brief Get the statistics of the flash accesses since the last reset
+ * @param  stats [OUT] - Statistics
+ **/
+void spinorfs_get_stats(struct spinorfs_stats *stats)
+{
+    spinorfs_ctx_get_stats(&default_ctx, stats);
+}
+
+/**
+ * @fn spinorfs_reset_stats
+ *
+ * @brief Reset the statistics of the flash accesses
+ **/
+void spinorfs_reset_stats(void)
+{
+    spinorfs_ctx_reset_stats(&default_ctx);
 }
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
 
 #include "bsd_eeprom_nvp.h"
 
@@ -57,96 +58,139 @@ static int eeprom_get_page_size(uint8_t type)
 }
 
 /**
- * @fn open_i2c_dev
+ * @fn eeprom_session_open
  *
- * @brief Open the i2c bus device.
+ * @brief Open the i2c bus device once for all the EEPROM transactions.
+ * @param  sess [OUT] - The EEPROM session
  * @param  i2c_device [IN] - I2C Device path
- * @return  File descriptor of the device
+ * @param  type [IN] - The type of eeprom
+ * @return  0 - Success
+ *          1 - Failure
  **/
-static int open_i2c_dev(char *i2c_device)
+static int eeprom_session_open(eeprom_session_t *sess, char *i2c_device,
+                               uint8_t type)
 {
-    int fd = open(i2c_device, O_RDWR);
-
-    if (fd < 0) {
+    sess->page_size = eeprom_get_page_size(type);
+    sess->bound_target = -1;
+    sess->syscalls = 1;
+    sess->ack_timeout_us = EEPROM_ACK_TIMEOUT_US;
+    sess->fd = open(i2c_device, O_RDWR);
+    if (sess->fd < 0) {
         log_printf(LOG_ERROR, "Failed to open I2C device!\n");
-        return -1;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn eeprom_session_close
+ *
+ * @brief Close the i2c bus device of the EEPROM session.
+ * @param  sess [IN/OUT] - The EEPROM session
+ **/
+static void eeprom_session_close(eeprom_session_t *sess)
+{
+    if (sess->fd < 0) {
+        return;
+    }
+    close(sess->fd);
+    sess->fd = -1;
+    sess->syscalls++;
+    log_printf(LOG_DEBUG, "EEPROM session: %u I2C system calls\n",
+               sess->syscalls);
+    if (sess->writes > 0) {
+        log_printf(LOG_DEBUG, "EEPROM writes: %u, wait avg %llu us"
+                   " max %llu us, %u ACK polls, %u timeouts\n",
+                   sess->writes,
+                   (unsigned long long)(sess->write_time_us / sess->writes),
+                   (unsigned long long)sess->write_time_max_us,
+                   sess->ack_polls, sess->ack_timeouts);
     }
+}
 
-    return fd;
+/**
+ * @fn eeprom_session_bind
+ *
+ * @brief Bind the i2c bus device to the target address for plain writes.
+ *        The ioctl is only sent when the target changes.
+ * @param  sess [IN/OUT] - The EEPROM session
+ * @param  target [IN] - EEPROM target address
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int eeprom_session_bind(eeprom_session_t *sess, uint8_t target)
+{
+    if (sess->bound_target == target) {
+        return EXIT_SUCCESS;
+    }
+    sess->syscalls++;
+    if (ioctl(sess->fd, I2C_SLAVE, target) < 0) {
+        sess->bound_target = -1;
+        return EXIT_FAILURE;
+    }
+    sess->bound_target = target;
+    return EXIT_SUCCESS;
 }
 
 /**
  * @fn i2c_controller_write
  *
  * @brief Write data to I2C device.
- * @param  i2c_device [IN] - I2C Device path
+ * @param  sess [IN/OUT] - The EEPROM session
  * @param  target [IN] - EEPROM target address
  * @param  data [IN] - Data buffer to write to device
  * @param  count [IN] - Number of data in byte
  * @return  0 - Success
  *          1 - Failure
  **/
-static int i2c_controller_write(char *i2c_dev, uint8_t target,
-                            uint8_t *data, size_t count)
+static int i2c_controller_write(eeprom_session_t *sess, uint8_t target,
+                                uint8_t *data, size_t count)
 {
-    int ret = EXIT_SUCCESS;
-    int fd = -1;
-
-    fd = open_i2c_dev(i2c_dev);
-    if (fd < 0)
+    if (eeprom_session_bind(sess, target) != EXIT_SUCCESS) {
         return EXIT_FAILURE;
-
-    if (ioctl(fd, I2C_SLAVE, target) < 0) {
-        close(fd);
-        ret = EXIT_FAILURE;
-        return ret;
     }
 
     /* Write the specified data onto the I2C bus */
-    ret = write(fd, data, count);
-    if (ret != (int)count) {
+    sess->syscalls++;
+    if (write(sess->fd, data, count) != (ssize_t)count) {
         log_printf(LOG_ERROR, "Failed to write data to I2C bus\n");
-        ret = EXIT_FAILURE;
+        return EXIT_FAILURE;
     }
-    close(fd);
-    return ret;
+    return EXIT_SUCCESS;
 }
 
 /**
  * @fn i2c_controller_read
  *
  * @brief Read data from I2C device.
- * @param  i2c_device [IN] - I2C Device path
+ * @param  sess [IN/OUT] - The EEPROM session
  * @param  target [IN] - EEPROM target address
- * @param  wr_data [IN] - Data to write to device
+ * @param  wr_data [IN] - Offset address to write to device
+ * @param  wr_len [IN] - Number of offset address bytes
  * @param  data [OUT] - Data buffer to read from device
  * @param  data_len [IN] - Number of data in byte
  * @return  0 - Success
  *          1 - Failure
  **/
-static int i2c_controller_read(char *i2c_dev, uint8_t target, uint8_t *wr_data,
-                           uint8_t *data, size_t data_len)
+static int i2c_controller_read(eeprom_session_t *sess, uint8_t target,
+                               uint8_t *wr_data, size_t wr_len,
+                               uint8_t *data, size_t data_len)
 {
     int ret = EXIT_SUCCESS;
     struct i2c_rdwr_ioctl_data ioctl_data;
     struct i2c_msg i2c_msgs[2];
-    int fd = -1;
 
-    fd = open_i2c_dev(i2c_dev);
-    if (fd < 0)
+    if (data_len > EEPROM_MAX_READ_SIZE) {
+        log_printf(LOG_ERROR, "I2C read of %d bytes exceeds %d bytes\n",
+                   (int)data_len, EEPROM_MAX_READ_SIZE);
         return EXIT_FAILURE;
-
-    if (data_len > EEPROM_MAX_PAGE_SIZE_SUPPORT) {
-        log_printf(LOG_NORMAL,
-                   "[WARN] Sequential read should not exceed %d bytes, \
-                    otherwise the read data will be rolled over!\n",
-                    EEPROM_MAX_PAGE_SIZE_SUPPORT);
     }
 
     /* A dummy write operation should be done according to the I2C protocol */
     ioctl_data.nmsgs = 2;
     ioctl_data.msgs = i2c_msgs;
-    ioctl_data.msgs[0].len = MAX_EEPROM_ADDR_LEN;
+    ioctl_data.msgs[0].len = wr_len;
     ioctl_data.msgs[0].addr = target;
     ioctl_data.msgs[0].flags = 0;
     ioctl_data.msgs[0].buf = wr_data;
@@ -157,41 +201,108 @@ static int i2c_controller_read(char *i2c_dev, uint8_t target, uint8_t *wr_data,
     ioctl_data.msgs[1].flags = I2C_M_RD | I2C_M_NOSTART;
     ioctl_data.msgs[1].buf = data;
 
-    if (ioctl(fd, I2C_RDWR, &ioctl_data) < 0) {
+    sess->syscalls++;
+    if (ioctl(sess->fd, I2C_RDWR, &ioctl_data) < 0) {
         log_printf(LOG_ERROR,
                    "Failed to read data from EEPROM @0x%x via i2c!\n", target);
         ret = EXIT_FAILURE;
     }
-    close(fd);
 
     return ret;
 }
 
+/**
+ * @fn eeprom_elapsed_us
+ *
+ * @brief Microseconds elapsed since a monotonic time stamp
+ * @param  start [IN] - Time stamp taken with CLOCK_MONOTONIC
+ * @return  Elapsed time in microseconds
+ **/
+static uint64_t eeprom_elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000 +
+           (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+ * @fn eeprom_wait_write
+ *
+ * @brief Wait for the end of the write cycle of a page write. The EEPROM
+ *        does not ACK its address until the cycle is done, so it is polled
+ *        with zero-length writes. When polling times out or the adapter
+ *        does not support it, sleep up to the worst-case write cycle time.
+ * @param  sess [IN/OUT] - The EEPROM session, bound to the written target
+ **/
+static void eeprom_wait_write(eeprom_session_t *sess)
+{
+    struct timespec start;
+    uint64_t elapsed = 0;
+    uint8_t dummy = 0;
+    int acked = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (sess->ack_timeout_us > 0) {
+        sess->syscalls++;
+        sess->ack_polls++;
+        if (write(sess->fd, &dummy, 0) == 0) {
+            acked = 1;
+            break;
+        }
+        if (errno != ENXIO && errno != EREMOTEIO && errno != EIO &&
+            errno != EAGAIN && errno != ETIMEDOUT) {
+            log_printf(LOG_DEBUG, "EEPROM ACK polling unsupported: %s\n",
+                       strerror(errno));
+            sess->ack_timeout_us = 0;
+            break;
+        }
+        elapsed = eeprom_elapsed_us(&start);
+        if (elapsed >= sess->ack_timeout_us) {
+            sess->ack_timeouts++;
+            break;
+        }
+        usleep(EEPROM_ACK_POLL_US);
+    }
+
+    if (!acked) {
+        /* Fall back on the worst-case write cycle time */
+        elapsed = eeprom_elapsed_us(&start);
+        if (elapsed < EEPROM_WRITE_CYCLE_US) {
+            usleep(EEPROM_WRITE_CYCLE_US - elapsed);
+        }
+    }
+
+    elapsed = eeprom_elapsed_us(&start);
+    sess->writes++;
+    sess->write_time_us += elapsed;
+    if (elapsed > sess->write_time_max_us) {
+        sess->write_time_max_us = elapsed;
+    }
+}
+
 /**
  * @fn detect_eeprom
  *
  * @brief Detect the EEPROM device.
- * @param  i2c_device [IN] - I2C Device path
+ * @param  sess [IN/OUT] - The EEPROM session
  * @param  target [IN] - EEPROM target address
  * @return  0 - Success
  *          1 - Failure
  **/
-static int detect_eeprom(char *i2c_dev, uint8_t target)
+static int detect_eeprom(eeprom_session_t *sess, uint8_t target)
 {
     uint8_t buff[1];
-    int ret = EXIT_SUCCESS;
 
-    ret = i2c_controller_write(i2c_dev, target, buff, 0);
-    if (ret < 0)
-        ret = EXIT_FAILURE;
-    return ret;
+    return i2c_controller_write(sess, target, buff, 0);
 }
 
 /**
  * @fn eeprom_rd_wr
  *
  * @brief Read/write data from/to EEPROM device.
- * @param  i2c_device [IN] - I2C Device path
+ * @param  sess [IN/OUT] - The EEPROM session
  * @param  target [IN] - EEPROM target address
  * @param  offset [IN] - The offset to read/write data
  * @param  buf [OUT/IN] - Data buffer for read/write data
@@ -199,21 +310,23 @@ static int detect_eeprom(char *i2c_dev, uint8_t target)
  * @param  wr_flag [IN] - Option to select read or write operation
  * @return  Size of read/written data. Error return -1
  **/
-static ssize_t eeprom_rd_wr(char *i2c_dev, uint8_t target,
+static ssize_t eeprom_rd_wr(eeprom_session_t *sess, uint8_t target,
                             uint32_t offset, uint8_t *buf,
                             ssize_t size, uint8_t rw_flag)
 {
     ssize_t ret, bytes, len;
     int pagesize;
     uint8_t wr_buf[EEPROM_MAX_PAGE_SIZE_SUPPORT + MAX_EEPROM_ADDR_LEN];
-    uint8_t rd_buf[EEPROM_MAX_PAGE_SIZE_SUPPORT];
     uint8_t *p = buf;
     uint16_t buf_off, off_tmp;
-    uint32_t off;
+    uint32_t off, bank_size;
+    uint8_t page_target;
 
     len = size;
-    pagesize = eeprom_get_page_size(EEPROM_256B);
+    pagesize = sess->page_size;
     off = offset;
+    /* EEPROMs with a 1 byte offset address use one target per 256 bytes */
+    bank_size = (pagesize == EEPROM_8B_PAGE_SIZE) ? 0x100 : 0x10000;
 loop:
     if (rw_flag == EEPROM_WR_FLG)
         log_printf(LOG_DEBUG, "\rPrograming FW file: %d/%d (%d%%)",
@@ -227,19 +340,11 @@ loop:
 
     /**
      * The target I2C EEPROM bus addresses start from 0x50 upto 0x53.
-     * Each I2C target can address a range of 64KB.
-     * Readjust the offset to address a total of 256KB eeprom memory.
+     * Each I2C target can address a bank of bank_size bytes.
+     * Readjust the offset to address the following banks.
      **/
-    if (off >= 0x30000) {
-        off_tmp = (uint16_t)(off - 0x30000);
-    } else if (off >= 0x20000) {
-        off_tmp = (uint16_t)(off - 0x20000);
-    } else if (off >= 0x10000) {
-        off_tmp = (uint16_t)(off - 0x10000);
-    } else {
-        off_tmp = (uint16_t)off;
-    }
-    target = target + off / 0x10000;
+    off_tmp = (uint16_t)(off % bank_size);
+    page_target = target + off / bank_size;
 
     /* EEPROM offset address */
     if (pagesize == EEPROM_256B_PAGE_SIZE ||
@@ -250,27 +355,36 @@ loop:
     } else {
         wr_buf[buf_off++] = off_tmp & 0x00FF;
     }
-    if (len >= pagesize)
-        bytes = pagesize;
-    else
+    if (rw_flag == EEPROM_WR_FLG) {
+        /* A page write wraps around inside the page, stop at its end */
+        bytes = pagesize - off % pagesize;
+    } else {
+        /* A sequential read runs up to the end of the bank */
+        bytes = bank_size - off_tmp;
+        if (bytes > EEPROM_MAX_READ_SIZE)
+            bytes = EEPROM_MAX_READ_SIZE;
+    }
+    if (bytes > len)
         bytes = len;
     if (rw_flag == EEPROM_WR_FLG) {
         memcpy(&wr_buf[buf_off], p, bytes);
-        ret = i2c_controller_write(i2c_dev, target, wr_buf, bytes + buf_off);
-        if (ret == EXIT_FAILURE) {
+        ret = i2c_controller_write(sess, page_target, wr_buf,
+                                   bytes + buf_off);
+        if (ret != EXIT_SUCCESS) {
             log_printf(LOG_ERROR, "Fail to send wr data\n");
             return -1;
         }
-        /* delay 10ms for the I2C write is done */
-        usleep(10 * 1000);
+        /* Wait for the write cycle of the page to be done */
+        eeprom_wait_write(sess);
+        sess->pages++;
+        sess->bytes_programmed += bytes;
     } else {
-        ret = i2c_controller_read(i2c_dev, target, wr_buf,
-                              rd_buf, bytes);
-        if (ret == -1) {
+        ret = i2c_controller_read(sess, page_target, wr_buf, buf_off,
+                                  p, bytes);
+        if (ret != EXIT_SUCCESS) {
             log_printf(LOG_ERROR, "Fail to read data\n");
             return -1;
         }
-        memcpy(p, rd_buf, bytes);
     }
     off += bytes;
     p += bytes;
@@ -281,6 +395,188 @@ loop:
     return (int)(size - len);
 }
 
+/**
+ * @fn bsd_blob_checksum
+ *
+ * @brief Calculate the checksum of the BSD blob and the checksum of its
+ *        first BSD_WA_BYTES_TO_CHECKSUM bytes (AC03 workaround) in one pass.
+ * @param  blob [IN] - BSD blob read from offset 0x00
+ * @param  length [IN] - Number of bytes covered by the checksum
+ * @param  checksum_wa [OUT] - Checksum of the AC03 workaround bytes
+ * @return  checksum of the whole blob
+ **/
+static uint8_t bsd_blob_checksum(const uint8_t *blob, uint32_t length,
+                                 uint8_t *checksum_wa)
+{
+    uint8_t sum = 0, sum_wa = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (i == BSD_WA_BYTES_TO_CHECKSUM)
+            sum_wa = sum;
+        sum = (uint8_t)(sum + blob[i]);
+    }
+    if (length <= BSD_WA_BYTES_TO_CHECKSUM)
+        sum_wa = sum;
+    *checksum_wa = (uint8_t)(0x100 - sum_wa);
+
+    return (uint8_t)(0x100 - sum);
+}
+
+/**
+ * @fn bsd_read_blob
+ *
+ * @brief Read the BSD blob from the EEPROM into memory. The blob covers
+ *        header.length bytes and at least the valid bit array and the
+ *        NVP fields. The bytes already read with the header are reused.
+ * @param  sess [IN/OUT] - The EEPROM session
+ * @param  target [IN] - EEPROM target address
+ * @param  header [IN] - NVP header of the BSD blob
+ * @param  head [IN] - Bytes of the blob read up to the end of the header
+ * @param  head_len [IN] - Size of head
+ * @param  blob [OUT] - Allocated blob, to be freed by the caller
+ * @param  blob_len [OUT] - Size of blob
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int bsd_read_blob(eeprom_session_t *sess, uint8_t target,
+                         const struct nvp_header *header,
+                         const uint8_t *head, uint32_t head_len,
+                         uint8_t **blob, uint32_t *blob_len)
+{
+    uint32_t len = header->length;
+    uint32_t end;
+    ssize_t sz;
+
+    end = head_len + BSD_VALID_BIT_ARR_SIZE;
+    if (len < end)
+        len = end;
+    end = header->data_offset + (uint32_t)header->count * header->field_size;
+    if (len < end)
+        len = end;
+    if (len > BSD_MAX_BLOB_SIZE) {
+        log_printf(LOG_ERROR, "Failed to validate NVP\n");
+        return EXIT_FAILURE;
+    }
+
+    *blob = (uint8_t *)malloc(len);
+    if (*blob == NULL) {
+        log_printf(LOG_ERROR, "Can't allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(*blob, head, head_len);
+    sz = eeprom_rd_wr(sess, target, head_len, *blob + head_len,
+                      len - head_len, EEPROM_RD_FLG);
+    if (sz == -1 || (uint32_t)sz != len - head_len) {
+        log_printf(LOG_ERROR, "ERROR in read NVP blob\n");
+        free(*blob);
+        *blob = NULL;
+        return EXIT_FAILURE;
+    }
+    *blob_len = len;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn bsd_blob_update
+ *
+ * @brief Apply new data to the in-memory BSD blob and record the bytes that
+ *        actually changed in the write plan.
+ * @param  blob [IN/OUT] - BSD blob read from offset 0x00
+ * @param  offset [IN] - Offset of the data in the blob
+ * @param  data [IN] - New data
+ * @param  len [IN] - Size of data
+ * @param  plan [IN/OUT] - Write plan of the blob
+ * @return  None
+ **/
+static void bsd_blob_update(uint8_t *blob, uint32_t offset,
+                           const uint8_t *data, uint32_t len,
+                           bsd_write_plan_t *plan)
+{
+    uint32_t first = len, last = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (blob[offset + i] != data[i]) {
+            if (first == len)
+                first = i;
+            last = i;
+        }
+    }
+    if (first == len)
+        return;
+    memcpy(blob + offset + first, data + first, last - first + 1);
+    if (plan->count < BSD_MAX_DIRTY_RANGES) {
+        plan->start[plan->count] = offset + first;
+        plan->end[plan->count] = offset + last + 1;
+        plan->count++;
+        return;
+    }
+    /* The blob holds the EEPROM content, so a range can cover more bytes */
+    if (plan->start[plan->count - 1] > offset + first)
+        plan->start[plan->count - 1] = offset + first;
+    if (plan->end[plan->count - 1] < offset + last + 1)
+        plan->end[plan->count - 1] = offset + last + 1;
+}
+
+/**
+ * @fn bsd_plan_write
+ *
+ * @brief Program the changed ranges of the BSD blob with the fewest page
+ *        writes. Ranges ending and starting in the same page are merged,
+ *        the bytes between them are rewritten from the blob which holds
+ *        the EEPROM content, so each page is programmed once.
+ * @param  sess [IN/OUT] - The EEPROM session
+ * @param  target [IN] - EEPROM target address
+ * @param  blob [IN] - Updated BSD blob
+ * @param  plan [IN/OUT] - Write plan of the blob, sorted on return
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int bsd_plan_write(eeprom_session_t *sess, uint8_t target,
+                          const uint8_t *blob, bsd_write_plan_t *plan)
+{
+    uint32_t pagesize = (uint32_t)sess->page_size;
+    uint32_t start, end, tmp, i = 0, writes = 0;
+    ssize_t sz;
+
+    /* Sort the ranges on their start offset */
+    for (uint32_t k = 1; k < plan->count; k++) {
+        for (uint32_t j = k; j > 0 && plan->start[j - 1] > plan->start[j];
+             j--) {
+            tmp = plan->start[j];
+            plan->start[j] = plan->start[j - 1];
+            plan->start[j - 1] = tmp;
+            tmp = plan->end[j];
+            plan->end[j] = plan->end[j - 1];
+            plan->end[j - 1] = tmp;
+        }
+    }
+
+    while (i < plan->count) {
+        start = plan->start[i];
+        end = plan->end[i];
+        /* Merge the next ranges touching the last page of this write */
+        for (i++; i < plan->count; i++) {
+            if (plan->start[i] > end &&
+                plan->start[i] / pagesize != (end - 1) / pagesize)
+                break;
+            if (plan->end[i] > end)
+                end = plan->end[i];
+        }
+        sz = eeprom_rd_wr(sess, target, start, (uint8_t *)blob + start,
+                          end - start, EEPROM_WR_FLG);
+        if (sz == -1) {
+            log_printf(LOG_ERROR, "ERROR in write NVP data.\n");
+            return EXIT_FAILURE;
+        }
+        writes++;
+    }
+    log_printf(LOG_DEBUG, "%u changed ranges programmed with %u writes, "
+               "%u pages\n", plan->count, writes, sess->pages);
+
+    return EXIT_SUCCESS;
+}
+
 /**
  * @fn bsd_eeprom_handler
  *
@@ -294,15 +590,22 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
     int ret = EXIT_SUCCESS;
     ssize_t sz = 0;
     char i2cdev[16] = {0};
+    eeprom_session_t sess = {.fd = -1};
     struct nvp_header header = {0};
-    uint32_t offset = BSD_OFFSET;
+    uint8_t head[BSD_OFFSET + sizeof(struct nvp_header)];
+    uint32_t head_len = BSD_OFFSET + sizeof(header) - BSD_NVP_HEADER_ADJUST;
     uint64_t nvp_value = 0;
     uint8_t nvp_valid = 0;
-    uint8_t *val_bit_arr = NULL;
-    uint8_t val_bit_arr_sz = 0;
-    uint8_t *data_cs = NULL;
+    uint8_t val_bit_arr[BSD_VALID_BIT_ARR_SIZE];
+    uint8_t val_bit_arr_sz = BSD_VALID_BIT_ARR_SIZE;
+    uint8_t *blob = NULL;
+    uint32_t blob_len = 0;
+    bsd_write_plan_t plan = {0};
     uint8_t need_update_cs = 0;
-    uint8_t checksum = 0, checksum_wa = 0;
+    uint8_t checksum = 0, checksum_wa = 0, delta_cs = 0, old_cs = 0;
+    uint8_t use_wa = 0, checksum_ok = 1;
+    uint8_t *field_data = NULL;
+    uint32_t field_offset = 0, val_offset = head_len, cs_len = 0;
 
     if (strlen((char *)ctrl->nvp_file) > 0 &&
         strcmp((char *)ctrl->nvp_file, BSD_NVP_FILE) != 0) {
@@ -316,29 +619,43 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
     if (ctrl->options[OPTION_S] == 0) {
         ctrl->target_addr = DEFAULT_I2C_EEPROM_ADDR;
     }
+    if (ctrl->options[OPTION_EEPROM_TYPE] == 0) {
+        ctrl->eeprom_type = DEFAULT_I2C_EEPROM_TYPE;
+    }
     /* Create the device file string */
     ret = snprintf(i2cdev, sizeof(i2cdev), "/dev/i2c-%d", ctrl->i2c_bus);
     if (ret >= (signed int)sizeof(i2cdev)) {
         log_printf(LOG_ERROR, "Overflow device length %s\n", i2cdev);
         return EXIT_FAILURE;
     }
+    ret = EXIT_SUCCESS;
+
+    /* Open the I2C bus once for all transactions */
+    if (eeprom_session_open(&sess, i2cdev, ctrl->eeprom_type) !=
+        EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+        goto out_hdl;
+    }
 
     /* Try to probe the EEPROM */
-    if (detect_eeprom(i2cdev, ctrl->target_addr)) {
+    if (detect_eeprom(&sess, ctrl->target_addr)) {
         log_printf(LOG_ERROR, "I2C device NOT FOUND!\n");
         ret = EXIT_FAILURE;
         goto out_hdl;
     }
 
-    /* Read NVP header */
-    sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, offset, (uint8_t *)&header,
-                      sizeof(struct nvp_header) - BSD_NVP_HEADER_ADJUST,
+    /*
+     * Read the BSV data and the NVP header in one transfer, the rest of the
+     * blob is appended to them once the header gives its length.
+     */
+    sz = eeprom_rd_wr(&sess, ctrl->target_addr, 0x00, head, head_len,
                       EEPROM_RD_FLG);
     if (sz == -1) {
         log_printf(LOG_ERROR, "ERROR in read NVP header\n");
         ret = EXIT_FAILURE;
         goto out_hdl;
     }
+    memcpy(&header, head + BSD_OFFSET, head_len - BSD_OFFSET);
     /* Verify Signature */
     if (memcmp(BSD_NVP_FILE, header.signature, sizeof(header.signature))) {
         log_printf(LOG_ERROR, "Failed to validate NVP\n");
@@ -346,79 +663,13 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
         goto out_hdl;
     }
 
-    /* Validate current checksum */
-    data_cs = (uint8_t *)malloc (header.length);
-    if (data_cs == NULL) {
-        log_printf(LOG_ERROR, "Can't allocate memory\n");
-        ret = EXIT_FAILURE;
-        goto out_hdl;
-    }
-    sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, 0x00, data_cs,
-                      header.length, EEPROM_RD_FLG);
-    if (sz == -1) {
-        log_printf(LOG_ERROR, "ERROR in read nvpberly file\n");
-        ret = EXIT_FAILURE;
-        goto out_hdl;
-    }
-    checksum = calculate_sum8(data_cs, header.length);
-    if (checksum != 0) {
-        /* Retry to apply the AC03 workaround for checksum */
-        checksum = calculate_sum8(data_cs, BSD_WA_BYTES_TO_CHECKSUM);
-        if (checksum != 0) {
-            log_printf(LOG_NORMAL, "WARN current checksum invalid\n");
-        } else {
-            checksum_wa = 1;
-        }
-    }
-
-    /* Dump the NVP blob */
-    if (ctrl->options[OPTION_D]) {
-        FILE *fp = NULL;
-        uint8_t *buff = NULL;
-
-        buff = (uint8_t *)malloc (header.length);
-        if (buff == NULL) {
-            log_printf(LOG_ERROR, "Can't allocate memory\n");
-            ret = EXIT_FAILURE;
-            goto out_hdl;
-        }
-
-        /*
-         * NVPBERLY is special structure which includes BSV data also.
-         * So dump data from offset 0x00
-         */
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr,
-                          0, buff,
-                          header.length, EEPROM_RD_FLG);
-        if (sz == -1 || sz != header.length) {
-            log_printf(LOG_ERROR, "ERROR in read NVP blob\n");
-            ret = EXIT_FAILURE;
-            free(buff);
-            goto out_hdl;
-        }
-
-        fp = fopen(ctrl->dump_file, "w");
-        if (fp == NULL) {
-            log_printf(LOG_ERROR, "Cannot open file %s\n", ctrl->dump_file);
-            ret = EXIT_FAILURE;
-            free(buff);
-            goto out_hdl;
-        }
-        fwrite(buff, 1, header.length, fp);
-        if (ferror(fp)) {
-            log_printf(LOG_ERROR, "ERROR in dump NVP blob\n");
-            ret = EXIT_FAILURE;
-        }
-        free(buff);
-        fclose(fp);
-        goto out_hdl;
-    }
-
     /* Upload/overwrite nvpberly file */
     if (ctrl->options[OPTION_O]) {
         FILE *fp = NULL;
         uint8_t *buff = NULL;
         ssize_t bytes = 0;
+        struct timespec start;
+        uint64_t elapsed = 0;
 
         fp = fopen(ctrl->upload_file, "rb");
         if (fp == NULL) {
@@ -441,12 +692,20 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
         fread(buff, sz, 1, fp);
 
         /* The NVPBERLY file includes BSV data so offset is 0x00 */
-        bytes = eeprom_rd_wr(i2cdev, ctrl->target_addr,
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bytes = eeprom_rd_wr(&sess, ctrl->target_addr,
                           0, buff,
                           sz, EEPROM_WR_FLG);
         if (bytes == -1 || sz != bytes) {
             log_printf(LOG_ERROR, "ERROR in write new NVP blob\n");
             ret = EXIT_FAILURE;
+        } else {
+            elapsed = eeprom_elapsed_us(&start);
+            log_printf(LOG_NORMAL, "Programmed %u bytes in %u pages of %d"
+                       " bytes, %llu bytes/s\n", sess.bytes_programmed,
+                       sess.pages, sess.page_size,
+                       elapsed ? (unsigned long long)bytes * 1000000 /
+                                 elapsed : 0ULL);
         }
 
         free(buff);
@@ -454,25 +713,53 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
         goto out_hdl;
     }
 
-    /* BSD is special case which fixes valid bit array size */
-    val_bit_arr_sz = BSD_VALID_BIT_ARR_SIZE;
-    val_bit_arr = (uint8_t *)malloc (val_bit_arr_sz);
-    if (val_bit_arr == NULL) {
-        log_printf(LOG_ERROR, "Can't allocate memory\n");
+    /* All other operations are served from one read of the blob */
+    if (bsd_read_blob(&sess, ctrl->target_addr, &header, head, head_len,
+                      &blob, &blob_len) != EXIT_SUCCESS) {
         ret = EXIT_FAILURE;
         goto out_hdl;
     }
-    memset(val_bit_arr, 0, val_bit_arr_sz);
-    /* Calculate offset of nvp valid bit array */
-    offset = BSD_OFFSET + sizeof(header) - BSD_NVP_HEADER_ADJUST;
-    sz = eeprom_rd_wr(i2cdev, ctrl->target_addr,
-                      offset, val_bit_arr,
-                      val_bit_arr_sz, EEPROM_RD_FLG);
-    if (sz == -1) {
-        log_printf(LOG_ERROR, "ERROR in read NVP valid bit array.\n");
-        ret = EXIT_FAILURE;
-        goto out_val_arr;
+
+    /* Validate current checksum */
+    checksum = bsd_blob_checksum(blob, header.length, &checksum_wa);
+    if (checksum != 0) {
+        /* Retry to apply the AC03 workaround for checksum */
+        if (checksum_wa != 0) {
+            log_printf(LOG_ERROR, "WARN current checksum invalid\n");
+            checksum_ok = 0;
+        } else {
+            use_wa = 1;
+        }
     }
+
+    /* Dump the NVP blob */
+    if (ctrl->options[OPTION_D]) {
+        FILE *fp = NULL;
+
+        /*
+         * NVPBERLY is special structure which includes BSV data also.
+         * So dump data from offset 0x00
+         */
+        fp = dump_file_open(ctrl->dump_file);
+        if (fp == NULL) {
+            log_printf(LOG_ERROR, "Cannot open file %s\n", ctrl->dump_file);
+            ret = EXIT_FAILURE;
+            goto out_hdl;
+        }
+        fwrite(blob, 1, header.length, fp);
+        if (ferror(fp)) {
+            log_printf(LOG_ERROR, "ERROR in dump NVP blob\n");
+            ret = EXIT_FAILURE;
+        }
+        if (dump_file_close(fp) != EXIT_SUCCESS) {
+            log_printf(LOG_ERROR, "ERROR in dump NVP blob\n");
+            ret = EXIT_FAILURE;
+        }
+        goto out_hdl;
+    }
+
+    /* BSD is special case which fixes valid bit array size */
+    memcpy(val_bit_arr, blob + val_offset, val_bit_arr_sz);
     #ifdef DEBUG
     log_printf(LOG_DEBUG, "Valid bit array value:");
     for (int i = 0; i < val_bit_arr_sz; i++) {
@@ -481,24 +768,22 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
     log_printf(LOG_DEBUG, "\n");
     #endif
 
+    /* The field and its valid bit are looked up in the blob */
+    if ((header.field_size != NVP_FIELD_SIZE_1 &&
+         header.field_size != NVP_FIELD_SIZE_4 &&
+         header.field_size != NVP_FIELD_SIZE_8) ||
+        ctrl->field_index >= header.count ||
+        ctrl->field_index >= val_bit_arr_sz * 8U) {
+        log_printf(LOG_ERROR, "Failed to validate NVP\n");
+        ret = EXIT_FAILURE;
+        goto out_hdl;
+    }
+    /* Calculate offset of nvp field */
+    field_offset = header.data_offset +
+                   ctrl->field_index * header.field_size;
+
     if (ctrl->options[OPTION_R]) {
-        if (ctrl->field_index >= header.count) {
-            log_printf(LOG_ERROR, "Failed to validate NVP\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
-        /* Calculate offset of nvp field */
-        offset = header.data_offset +
-                 ctrl->field_index * header.field_size;
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr,
-                          offset, (uint8_t *)&nvp_value,
-                          header.field_size, EEPROM_RD_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in read NVP field: %d\n",
-                       ctrl->field_index);
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
+        memcpy(&nvp_value, blob + field_offset, header.field_size);
 
         /* Get the bit of nvp field index */
         nvp_valid = UINT8_GET_BIT(val_bit_arr, ctrl->field_index);
@@ -512,7 +797,7 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
             log_printf(LOG_NORMAL, "0x%.2x 0x%.16llx\n",
                        nvp_valid, nvp_value);
         }
-        goto out_val_arr;
+        goto out_hdl;
     }
 
     if (ctrl->options[OPTION_W]) {
@@ -522,19 +807,10 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
                        "NVP data exceeds MAX value of field size %d bytes\n",
                        header.field_size);
             ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
-        /* Write new data */
-        offset = header.data_offset +
-                 ctrl->field_index * header.field_size;
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, offset,
-                          (uint8_t *)&(ctrl->nvp_data),
-                          header.field_size, EEPROM_WR_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in write NVP data.\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
+            goto out_hdl;
         }
+        /* New data */
+        field_data = (uint8_t *)&(ctrl->nvp_data);
         /* Update valid bit */
         if (ctrl->options[OPTION_V]) {
             if (ctrl->valid_bit == NVP_FIELD_IGNORE) {
@@ -545,20 +821,12 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
                 log_printf(LOG_ERROR, "Unsupported valid bit value: 0x%.2x\n",
                            ctrl->valid_bit);
                 ret = EXIT_FAILURE;
-                goto out_val_arr;
+                goto out_hdl;
             }
         } else {
             /* Set the nvp field by default */
             UINT8_SET_BIT(val_bit_arr, ctrl->field_index);
         }
-        offset = BSD_OFFSET + sizeof(header) - BSD_NVP_HEADER_ADJUST;
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, offset, val_bit_arr,
-                          val_bit_arr_sz, EEPROM_WR_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in write NVP valid bit.\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
         need_update_cs = 1;
     } else if (ctrl->options[OPTION_V]) {
         if (ctrl->valid_bit == NVP_FIELD_IGNORE) {
@@ -569,40 +837,15 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
             log_printf(LOG_ERROR, "Unsupported valid bit value: 0x%.2x\n",
                        ctrl->valid_bit);
             ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
-        offset = BSD_OFFSET + sizeof(header) - BSD_NVP_HEADER_ADJUST;
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, offset, val_bit_arr,
-                          val_bit_arr_sz, EEPROM_WR_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in write NVP valid bit.\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
+            goto out_hdl;
         }
         need_update_cs = 1;
     } else if (ctrl->options[OPTION_E]) {
         /* Erase NVP field by set its all data to 1 */
         nvp_value = ULLONG_MAX;
-        offset = header.data_offset +
-                 ctrl->field_index * header.field_size;
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, offset,
-                          (uint8_t *)&(nvp_value),
-                          header.field_size, EEPROM_WR_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in write NVP data.\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
+        field_data = (uint8_t *)&(nvp_value);
         /* Set the associated valid bit of NVP field to 0 */
         UINT8_CLEAR_BIT(val_bit_arr, ctrl->field_index);
-        offset = BSD_OFFSET + sizeof(header) - BSD_NVP_HEADER_ADJUST;
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, offset, val_bit_arr,
-                          val_bit_arr_sz, EEPROM_WR_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in write NVP valid bit.\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
-        }
         need_update_cs = 1;
     }
     #ifdef DEBUG
@@ -613,37 +856,52 @@ int bsd_eeprom_handler (nvparm_ctrl_t *ctrl)
     log_printf(LOG_DEBUG, "\n");
     #endif
     if (need_update_cs) {
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, 0x00, data_cs,
-                    header.length, EEPROM_RD_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in read nvpberly file\n");
-            ret = EXIT_FAILURE;
-            goto out_val_arr;
+        cs_len = use_wa ? BSD_WA_BYTES_TO_CHECKSUM : header.length;
+        /*
+         * The blob still holds the bytes before the update, so the new
+         * checksum follows from the changed bytes only. The changes are
+         * applied to the blob and programmed together once it is complete.
+         */
+        delta_cs = blob[BSD_CHECKSUM_OFFSET];
+        if (field_data != NULL) {
+            delta_cs = update_sum8(delta_cs, blob + field_offset,
+                                   field_data, field_offset,
+                                   header.field_size, cs_len);
+            bsd_blob_update(blob, field_offset, field_data,
+                            header.field_size, &plan);
         }
-        /* Reset checksum before calculate new value */
-        data_cs[BSD_CHECKSUM_OFFSET] = 0;
-        if (checksum_wa == 1) {
-            checksum = calculate_sum8(data_cs, BSD_WA_BYTES_TO_CHECKSUM);
-        } else {
-            checksum = calculate_sum8(data_cs, header.length);
+        delta_cs = update_sum8(delta_cs, blob + val_offset, val_bit_arr,
+                               val_offset, val_bit_arr_sz, cs_len);
+        bsd_blob_update(blob, val_offset, val_bit_arr, val_bit_arr_sz,
+                        &plan);
+        checksum = delta_cs;
+        if (!checksum_ok || ctrl->options[OPTION_VERIFY_CS]) {
+            /* Calculate the checksum over the whole updated blob */
+            old_cs = blob[BSD_CHECKSUM_OFFSET];
+            blob[BSD_CHECKSUM_OFFSET] = 0;
+            checksum = calculate_sum8(blob, cs_len);
+            blob[BSD_CHECKSUM_OFFSET] = old_cs;
+            if (checksum_ok && checksum != delta_cs) {
+                log_printf(LOG_ERROR, "WARN: Checksum update 0x%x mismatches "
+                           "full checksum 0x%x, use full checksum\n",
+                           delta_cs, checksum);
+            }
         }
-        /* Update new checksum */
-        sz = eeprom_rd_wr(i2cdev, ctrl->target_addr, BSD_CHECKSUM_OFFSET,
-                          &checksum, sizeof(checksum), EEPROM_WR_FLG);
-        if (sz == -1) {
-            log_printf(LOG_ERROR, "ERROR in update new checksum.\n");
+        bsd_blob_update(blob, BSD_CHECKSUM_OFFSET, &checksum,
+                        sizeof(checksum), &plan);
+        /* Program the field, valid bit array and checksum together */
+        if (bsd_plan_write(&sess, ctrl->target_addr, blob, &plan) !=
+            EXIT_SUCCESS) {
             ret = EXIT_FAILURE;
+            goto out_hdl;
         }
         log_printf(LOG_DEBUG, "DONE Update new checksum\n");
     }
 
-out_val_arr:
-    if (val_bit_arr)
-        free(val_bit_arr);
-
 out_hdl:
-    if (data_cs)
-        free(data_cs);
+    if (blob)
+        free(blob);
+    eeprom_session_close(&sess);
 
     return ret;
-}
\ No newline at end of file
+}
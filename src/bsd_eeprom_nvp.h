@@ -26,6 +26,19 @@
 #define EEPROM_WR_FLG                   1
 
 #define MAX_EEPROM_ADDR_LEN             2
+/* Longest I2C_RDWR message accepted by the i2c-dev driver */
+#define EEPROM_MAX_READ_SIZE            8192
+
+/* Worst-case write cycle time of the EEPROM after a page write */
+#define EEPROM_WRITE_CYCLE_US           (10 * 1000)
+/* Time between two ACK polls of the EEPROM busy with a write cycle */
+#define EEPROM_ACK_POLL_US              100
+/* ACK polling time unless Makefile define, 0 sleeps the worst case */
+#ifdef NVPARM_EEPROM_ACK_TIMEOUT_US
+#define EEPROM_ACK_TIMEOUT_US           NVPARM_EEPROM_ACK_TIMEOUT_US
+#else
+#define EEPROM_ACK_TIMEOUT_US           EEPROM_WRITE_CYCLE_US
+#endif
 
 #define BSD_PARTITION_NAME              "nvparamb"
 #define BSD_NVP_FILE                    "NVPBERLY"
@@ -34,6 +47,8 @@
 #define BSD_CHECKSUM_OFFSET             44
 #define BSD_VALID_BIT_ARR_SIZE          8
 #define BSD_NVP_HEADER_ADJUST           4
+/* Largest BSD blob, the address range of a 2 byte offset EEPROM */
+#define BSD_MAX_BLOB_SIZE               0x10000
 
 enum eeprom_type {
     EEPROM_256B     = 0,
@@ -55,6 +70,32 @@ enum eeprom_type {
  **/
 #define BSD_WA_BYTES_TO_CHECKSUM           148
 
+/* I2C bus of the EEPROM kept open for all transactions of an operation */
+typedef struct eeprom_session {
+    int fd;                             // I2C bus device file descriptor
+    int page_size;                      // Write page size of the EEPROM
+    int bound_target;                   // Address set by I2C_SLAVE, -1 if none
+    uint32_t syscalls;                  // System calls sent to the I2C bus
+    uint32_t ack_timeout_us;            // ACK polling time, 0 if disabled
+    uint32_t writes;                    // Page writes waited for
+    uint32_t ack_polls;                 // Polls of the EEPROM busy writing
+    uint32_t ack_timeouts;              // Writes not ACKed in ack_timeout_us
+    uint64_t write_time_us;             // Total write cycle wait time
+    uint64_t write_time_max_us;         // Longest write cycle wait time
+    uint32_t pages;                     // Page writes sent
+    uint32_t bytes_programmed;          // Bytes sent by the page writes
+} eeprom_session_t;
+
+/* Bytes of the BSD blob changed by an operation, at most field/valid/checksum */
+#define BSD_MAX_DIRTY_RANGES            3
+
+/* Changed byte ranges of the BSD blob to program with page writes */
+typedef struct bsd_write_plan {
+    uint32_t count;                     // Number of ranges in use
+    uint32_t start[BSD_MAX_DIRTY_RANGES];   // First changed byte
+    uint32_t end[BSD_MAX_DIRTY_RANGES];     // Byte after the last change
+} bsd_write_plan_t;
+
 extern int bsd_eeprom_handler (nvparm_ctrl_t *ctrl);
 
 #endif  /* _BSD_EEPROM_NVP_H_ */
\ No newline at end of file
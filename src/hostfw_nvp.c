@@ -11,52 +11,85 @@
  *
  **/
 
+#include <errno.h>
 #include <fcntl.h>
 #include <mtd/mtd-user.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/file.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <limits.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "hostfw_nvp.h"
+#include "nvp_image.h"
 #include "spinorfs.h"
 
 /**
- * @fn find_host_mtd_partition
+ * @fn flock_device
+ *
+ * @brief Lock the MTD device exclusively, waiting while another nvparm or
+ *        the nvparm daemon holds it
+ * @param  fd [IN] - MTD device file descriptor
+ * @param  name [IN] - MTD device path for the messages
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int flock_device(int fd, const char *name)
+{
+    int ret = flock(fd, LOCK_EX | LOCK_NB);
+
+    if (ret < 0 && errno == EWOULDBLOCK) {
+        log_printf(LOG_DEBUG, "%s is in use, waiting\n", name);
+        do {
+            ret = flock(fd, LOCK_EX);
+        } while (ret < 0 && errno == EINTR);
+    }
+    if (ret < 0) {
+        log_printf(LOG_ERROR, "Failed to lock %s: %s\n", name,
+                   strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn find_host_mtd_device
  *
- * @brief Detect the Host MTD partition
+ * @brief Get the path of the Host MTD device: the one given by -D or the
+ *        MTD partition labelled HOST_SPI_FLASH_MTD_NAME
  * @param  ctrl [IN] - Input control structure
- * @param  fd [OUT] - Device file descriptor output
+ * @param  mtd_dev [OUT] - MTD device path
+ * @param  len [IN] - Size of mtd_dev
  * @return  0 - Success
  *          1 - Failure
  **/
-int find_host_mtd_partition (nvparm_ctrl_t *ctrl, int *fd)
+int find_host_mtd_device (nvparm_ctrl_t *ctrl, char *mtd_dev, size_t len)
 {
     int ret = EXIT_SUCCESS;
     int nMTDDeviceNumber= -1;
-    char *argv_dev_ptr;
     char temp_mtd[4] = {0}, *temp;
     char proc_buf[80];
-    int dev_fd = -1;
-    struct mtd_info_user mtd;
-    char mtd_dev[MTD_DEV_SIZE] = {0};
 
     if (ctrl->options[OPTION_DEV]) {
-        strncpy(&mtd_dev[0], ctrl->device_name, sizeof(mtd_dev));
-        goto open_dev;
+        if (strlen(ctrl->device_name) >= len) {
+            log_printf(LOG_ERROR,"Buffer Overflow.\n");
+            return EXIT_FAILURE;
+        }
+        strncpy(mtd_dev, ctrl->device_name, len);
+        return EXIT_SUCCESS;
     }
     /* Finding the MTD partition for host SPI chip */
     FILE *proc_fp;
     if ((proc_fp = fopen(PROC_MTD_INFO, "r")) == NULL) {
         log_printf(LOG_ERROR, "Unable to open %s to get MTD info...\n",
             PROC_MTD_INFO);
-        ret = EXIT_FAILURE;
-        goto out;
+        return EXIT_FAILURE;
     }
 
     while (fgets(proc_buf, sizeof(proc_buf), proc_fp) != NULL) {
@@ -65,8 +98,7 @@ int find_host_mtd_partition (nvparm_ctrl_t *ctrl, int *fd)
             if(temp == NULL) {
                 log_printf(LOG_ERROR,"Error in finding the BIOS Partition \n");
                 fclose(proc_fp);
-                ret = EXIT_FAILURE;
-                goto out;
+                return EXIT_FAILURE;
             }
 
             memcpy((char *)&temp_mtd, (char *)&temp[3], (strlen(temp) - 3));
@@ -76,26 +108,58 @@ int find_host_mtd_partition (nvparm_ctrl_t *ctrl, int *fd)
     fclose(proc_fp);
     if (nMTDDeviceNumber == -1) {
         log_printf(LOG_ERROR,"Unable to find HOST SPI MTD partition...\n");
-        ret = EXIT_FAILURE;
-        goto out;
+        return EXIT_FAILURE;
     }
 
-    ret = snprintf(&mtd_dev[0], MTD_DEV_SIZE, "/dev/mtd%d", nMTDDeviceNumber);
-    if(ret  >= MTD_DEV_SIZE || ret < 0) {
+    ret = snprintf(mtd_dev, len, "/dev/mtd%d", nMTDDeviceNumber);
+    if(ret  >= (int)len || ret < 0) {
         log_printf(LOG_ERROR,"Buffer Overflow.\n");
-        ret = EXIT_FAILURE;
-        goto out;
+        return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn find_host_mtd_partition
+ *
+ * @brief Detect the Host MTD partition. A device opened to write is locked
+ *        exclusively, waiting for the other writer of the device (nvparm
+ *        or the nvparm daemon serving a request) to finish.
+ * @param  ctrl [IN] - Input control structure
+ * @param  read_only [IN] - Open the device read only, without O_SYNC
+ * @param  fd [OUT] - Device file descriptor output
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int find_host_mtd_partition (nvparm_ctrl_t *ctrl, int read_only, int *fd)
+{
+    int ret = EXIT_SUCCESS;
+    char *argv_dev_ptr;
+    int dev_fd = -1;
+    struct mtd_info_user mtd;
+    char mtd_dev[MTD_DEV_SIZE] = {0};
 
-open_dev:
+    ret = find_host_mtd_device(ctrl, mtd_dev, sizeof(mtd_dev));
+    if (ret != EXIT_SUCCESS) {
+        goto out;
+    }
     argv_dev_ptr = &mtd_dev[0];
 
-    dev_fd  = open(argv_dev_ptr, O_SYNC | O_RDWR);
+    dev_fd  = open(argv_dev_ptr, read_only ? O_RDONLY : (O_SYNC | O_RDWR));
     if (dev_fd < 0) {
         log_printf(LOG_ERROR, "Failed to open: %s\n", argv_dev_ptr);
         ret = EXIT_FAILURE;
         goto out;
     }
+    /*
+     * A mount keeps littlefs state and cached blocks in memory, which
+     * another writer of the device would make stale.
+     */
+    if (!read_only && flock_device(dev_fd, argv_dev_ptr) != EXIT_SUCCESS) {
+        close(dev_fd);
+        ret = EXIT_FAILURE;
+        goto out;
+    }
 
     /* Get the MTD device info */
     ret = ioctl(dev_fd, MEMGETINFO, &mtd);
@@ -110,391 +174,634 @@ out:
     return ret;
 }
 
+/* Double buffer shared by the dump reader thread and the output writer */
+struct dump_stream {
+    spinorfs_file_t *nvp_fp;            // NVP file being dumped
+    uint32_t chunk_size;                // Size of each buffer
+    uint8_t *buff[2];                   // Buffers filled in turn
+    int len[2];                         // Bytes read, 0 at EOF, -1 on error
+    int full[2];                        // Buffer waits for the writer
+    int stop;                           // Writer failed, stop reading
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/**
+ * @fn dump_reader
+ *
+ * @brief Reader thread of a dump: fill the buffers in turn with the next
+ *        chunk of the NVP file until its end or an error.
+ * @param  arg [IN] - The dump_stream
+ * @return  NULL
+ **/
+static void *dump_reader(void *arg)
+{
+    struct dump_stream *ds = arg;
+    uint32_t offset = 0;
+    int i = 0, len = 0, stop = 0;
+
+    do {
+        pthread_mutex_lock(&ds->lock);
+        while (ds->full[i] && !ds->stop) {
+            pthread_cond_wait(&ds->cond, &ds->lock);
+        }
+        stop = ds->stop;
+        pthread_mutex_unlock(&ds->lock);
+        if (stop) {
+            break;
+        }
+
+        len = spinorfs_read(ds->nvp_fp, (char *)ds->buff[i], offset,
+                            ds->chunk_size);
+
+        pthread_mutex_lock(&ds->lock);
+        ds->len[i] = len;
+        ds->full[i] = 1;
+        pthread_cond_signal(&ds->cond);
+        pthread_mutex_unlock(&ds->lock);
+
+        if (len > 0) {
+            offset += len;
+        }
+        i ^= 1;
+    } while (len > 0);
+
+    return NULL;
+}
+
 /**
  * @fn dump_nvp_hdlr
  *
- * @brief Dump NVPARAM file into specific target file
+ * @brief Dump NVPARAM file into specific target file. A reader thread
+ *        reads the next chunk from the flash while the previous one is
+ *        written out.
  * @param  nvp_file [IN] - NVPARAM file to be dumped from
- * @param  dump_file [IN] - Target file stores the dumped NVPARAM data
+ * @param  dump_file [IN] - Target file stores the dumped NVPARAM data,
+ *                          "-" for the standard output
+ * @param  chunk_size [IN] - Size of each read of the NVPARAM file
  * @return  0 - Success
  *          1 - Failure
  **/
-int dump_nvp_hdlr(char *nvp_file, char *dump_file)
+int dump_nvp_hdlr(char *nvp_file, char *dump_file, uint32_t chunk_size)
 {
     int ret = EXIT_SUCCESS;
-    uint8_t buff[DEFAULT_PAGE_SIZE] = {0};
+    struct dump_stream ds = {0};
+    pthread_t reader;
     FILE *fp = NULL;
-    int byte_cnt = 0;
-    uint32_t offset= 0;
+    int i = 0, len = 0;
 
-    if (nvp_file == NULL || dump_file == NULL) {
+    if (nvp_file == NULL || dump_file == NULL || chunk_size == 0) {
         return EXIT_FAILURE;
     }
     /* Open nvp_file as READ ONLY */
-    ret = spinorfs_open(nvp_file, SPINORFS_O_RDONLY);
-    if (ret < 0) {
-        log_printf(LOG_ERROR, "ERROR %d in open file %s\n", ret, nvp_file);
+    ds.nvp_fp = spinorfs_open(nvp_file, SPINORFS_O_RDONLY);
+    if (ds.nvp_fp == NULL) {
+        log_printf(LOG_ERROR, "ERROR in open file %s\n", nvp_file);
         return EXIT_FAILURE;
     }
 
-    fp = fopen(dump_file, "w");
+    ds.chunk_size = chunk_size;
+    ds.buff[0] = malloc(chunk_size);
+    ds.buff[1] = malloc(chunk_size);
+    if (ds.buff[0] == NULL || ds.buff[1] == NULL) {
+        log_printf(LOG_ERROR, "ERROR: Failed to allocate memory\n");
+        ret = EXIT_FAILURE;
+        goto out_buff;
+    }
+
+    fp = dump_file_open(dump_file);
     if (fp == NULL) {
-        log_printf(LOG_ERROR, "Cannot open file %s\n", nvp_file);
-        spinorfs_close();
-        return EXIT_FAILURE;
+        log_printf(LOG_ERROR, "Cannot open file %s\n", dump_file);
+        ret = EXIT_FAILURE;
+        goto out_buff;
     }
-    while ((byte_cnt = spinorfs_read((char *)buff, offset, sizeof(buff))) > 0) {
-        fwrite(buff, 1, byte_cnt, fp);
-        if (ferror(fp)) {
+
+    pthread_mutex_init(&ds.lock, NULL);
+    pthread_cond_init(&ds.cond, NULL);
+    if (pthread_create(&reader, NULL, dump_reader, &ds) != 0) {
+        log_printf(LOG_ERROR, "ERROR in create dump reader thread\n");
+        ret = EXIT_FAILURE;
+        goto out_sync;
+    }
+
+    for (i = 0; ; i ^= 1) {
+        pthread_mutex_lock(&ds.lock);
+        while (!ds.full[i]) {
+            pthread_cond_wait(&ds.cond, &ds.lock);
+        }
+        len = ds.len[i];
+        pthread_mutex_unlock(&ds.lock);
+
+        if (len < 0) {
+            log_printf(LOG_ERROR, "ERROR in read file %s\n", nvp_file);
+            ret = EXIT_FAILURE;
+        } else if (len > 0 &&
+                   fwrite(ds.buff[i], 1, len, fp) != (size_t)len) {
             log_printf(LOG_ERROR, "ERROR in write to file %s\n", dump_file);
             ret = EXIT_FAILURE;
+        }
+
+        pthread_mutex_lock(&ds.lock);
+        ds.full[i] = 0;
+        ds.stop = (ret != EXIT_SUCCESS);
+        pthread_cond_signal(&ds.cond);
+        pthread_mutex_unlock(&ds.lock);
+
+        if (len <= 0 || ret != EXIT_SUCCESS) {
             break;
         }
-        offset += byte_cnt;
     }
+    pthread_join(reader, NULL);
+
+out_sync:
+    pthread_cond_destroy(&ds.cond);
+    pthread_mutex_destroy(&ds.lock);
+    if (dump_file_close(fp) != EXIT_SUCCESS && ret == EXIT_SUCCESS) {
+        log_printf(LOG_ERROR, "ERROR in write to file %s\n", dump_file);
+        ret = EXIT_FAILURE;
+    }
+out_buff:
+    free(ds.buff[0]);
+    free(ds.buff[1]);
+    spinorfs_close(ds.nvp_fp);
+
+    return ret;
+}
+
+/**
+ * @fn dump_chunk_size
+ *
+ * @brief Size of the reads of a dump: the erase block size of the device,
+ *        or the size requested with --chunk-size when smaller.
+ * @param  ctrl [IN] - The nvparam controller structure
+ * @param  dev_fd [IN] - MTD device file descriptor
+ * @return  The chunk size in bytes
+ **/
+static uint32_t dump_chunk_size(nvparm_ctrl_t *ctrl, int dev_fd)
+{
+    struct mtd_info_user mtd = {0};
+    uint32_t chunk_size = DEFAULT_PAGE_SIZE;
+
+    if (ioctl(dev_fd, MEMGETINFO, &mtd) == 0 && mtd.erasesize > 0) {
+        chunk_size = mtd.erasesize;
+    }
+    if (ctrl->options[OPTION_CHUNK_SIZE]) {
+        if (ctrl->chunk_size > chunk_size) {
+            log_printf(LOG_ERROR, "WARN: Chunk size limited to the erase"
+                                  " block size %u\n", chunk_size);
+        } else {
+            chunk_size = ctrl->chunk_size;
+        }
+    }
+    return chunk_size;
+}
+
+/**
+ * @fn upload_check_file
+ *
+ * @brief Validate the NVP header and checksum of the upload file and
+ *        compare it with the NVP file on the flash, one chunk at a time.
+ * @param  fp [IN] - Upload file, read from its start
+ * @param  size [IN] - Size of the upload file
+ * @param  nvp_fp [IN] - NVPARAM file to be overwritten
+ * @param  identical [OUT] - 1 if nvp_fp already holds the same content
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int upload_check_file(FILE *fp, uint32_t size,
+                             spinorfs_file_t *nvp_fp, int *identical)
+{
+    int ret = EXIT_SUCCESS;
+    uint8_t buff[DEFAULT_PAGE_SIZE];
+    uint8_t nvp_buff[DEFAULT_PAGE_SIZE];
+    struct nvp_header header;
+    uint32_t offset = 0, bytes = 0, cs_length = 0;
+    uint8_t sum = 0;
+
+    *identical = 0;
+    if (size < sizeof(header) ||
+        fread(&header, 1, sizeof(header), fp) != sizeof(header)) {
+        log_printf(LOG_ERROR, "ERROR in read NVP header\n");
+        return EXIT_FAILURE;
+    }
+    if (nvp_image_check_header(&header, size) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (header.flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) {
+        cs_length = header.length;
+    }
+    rewind(fp);
 
-    spinorfs_close();
-    if (fp)
-        fclose(fp);
+    *identical = 1;
 
+    for (offset = 0; offset < size; offset += bytes) {
+        bytes = size - offset < sizeof(buff) ? size - offset : sizeof(buff);
+        if (fread(buff, 1, bytes, fp) != bytes) {
+            log_printf(LOG_ERROR, "ERROR in read file\n");
+            return EXIT_FAILURE;
+        }
+        for (uint32_t i = 0; i < bytes && offset + i < cs_length; i++) {
+            sum = (uint8_t)(sum + buff[i]);
+        }
+        if (*identical) {
+            *identical = spinorfs_read(nvp_fp, (char *)nvp_buff, offset,
+                                       bytes) == (int)bytes &&
+                         memcmp(buff, nvp_buff, bytes) == 0;
+        }
+    }
+    /* The NVP file on the flash must not be longer */
+    if (*identical &&
+        spinorfs_read(nvp_fp, (char *)nvp_buff, offset, 1) != 0) {
+        *identical = 0;
+    }
+
+    /* The checksum makes the sum of the covered bytes zero */
+    if (sum != 0) {
+        log_printf(LOG_ERROR, "Invalid NVP checksum: 0x%.2x\n",
+                   header.checksum);
+        ret = EXIT_FAILURE;
+    }
     return ret;
 }
 
+/**
+ * @fn upload_diff_write
+ *
+ * @brief Write only the byte ranges of the upload file that differ from
+ *        the NVP file of the same size. Ranges separated by less than
+ *        UPLOAD_DIFF_GAP equal bytes are written together.
+ * @param  fp [IN] - Upload file, read from its start
+ * @param  nvp_fp [IN] - NVPARAM file opened to read and write
+ * @param  size [IN] - Size of both files
+ * @param  programmed [OUT] - Number of bytes written
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int upload_diff_write(FILE *fp, spinorfs_file_t *nvp_fp,
+                             uint32_t size, uint32_t *programmed)
+{
+    uint8_t buff[DEFAULT_PAGE_SIZE];
+    uint8_t nvp_buff[DEFAULT_PAGE_SIZE];
+    uint32_t offset = 0, bytes = 0, start = 0, end = 0, i = 0;
+
+    *programmed = 0;
+    for (offset = 0; offset < size; offset += bytes) {
+        bytes = size - offset < sizeof(buff) ? size - offset : sizeof(buff);
+        if (fread(buff, 1, bytes, fp) != bytes ||
+            spinorfs_read(nvp_fp, (char *)nvp_buff, offset, bytes) !=
+            (int)bytes) {
+            log_printf(LOG_ERROR, "ERROR in read NVP file\n");
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < bytes; i++) {
+            if (buff[i] == nvp_buff[i]) {
+                continue;
+            }
+            start = i;
+            end = i + 1;
+            for (i = end; i < bytes && i - end < UPLOAD_DIFF_GAP; i++) {
+                if (buff[i] != nvp_buff[i]) {
+                    end = i + 1;
+                }
+            }
+            if (spinorfs_write(nvp_fp, (char *)buff + start, offset + start,
+                               end - start) != (int)(end - start)) {
+                log_printf(LOG_ERROR, "ERROR write to NVP file\n");
+                return EXIT_FAILURE;
+            }
+            *programmed += end - start;
+            i = end;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
 /**
  * @fn upload_nvp_hdlr
  *
- * @brief Upload NVPARAM file into specific target NVPARAM file
+ * @brief Upload NVPARAM file into specific target NVPARAM file. The upload
+ *        file is validated first, and nothing is written when the NVPARAM
+ *        file already holds the same content. The new content is written
+ *        to a temporary file renamed over the NVPARAM file once complete,
+ *        so the NVPARAM file is never left partly written.
  * @param  nvp_file [IN] - NVPARAM file to be overwritten
  * @param  upload_file [IN] - Upload NVPARAM file
+ * @param  diff [IN] - Only write the changed bytes in place when the size
+ *                     of the NVPARAM file is unchanged, and report the
+ *                     bytes programmed
  * @return  0 - Success
  *          1 - Failure
  **/
-int upload_nvp_hdlr(char *nvp_file, char *upload_file)
+int upload_nvp_hdlr(char *nvp_file, char *upload_file, int diff)
 {
     int ret = EXIT_SUCCESS;
     FILE *fp = NULL;
-    ssize_t sz, bytes;
-    uint8_t *buf = NULL, *write_buf = NULL;
-    uint32_t offset= 0;
+    spinorfs_file_t *nvp_fp = NULL;
+    uint8_t buff[DEFAULT_PAGE_SIZE];
+    char tmp_file[MAX_NAME_LENGTH + sizeof(UPLOAD_TMP_SUFFIX)];
+    long sz = 0;
+    uint32_t size = 0, offset = 0, bytes = 0, programmed = 0;
+    int identical = 0;
 
     if (nvp_file == NULL || upload_file == NULL) {
         return EXIT_FAILURE;
     }
 
-    /* Open nvp_file as WRITE ONLY */
-    ret = spinorfs_open(nvp_file, SPINORFS_O_WRONLY | SPINORFS_O_TRUNC);
-    if (ret < 0) {
-        log_printf(LOG_ERROR, "ERROR %d in open file %s\n", ret, nvp_file);
-        return EXIT_FAILURE;
-    }
-
     fp = fopen(upload_file, "rb");
     if (fp == NULL) {
         log_printf(LOG_ERROR, "Cannot open file %s\n", upload_file);
-        spinorfs_close();
         return EXIT_FAILURE;
     }
 
     fseek(fp, 0, SEEK_END);
     sz = ftell(fp);
-    log_printf(LOG_DEBUG, "[upload] new file %s size: %d\n", upload_file, sz);
+    if (sz < 0 || (unsigned long)sz > UINT32_MAX) {
+        log_printf(LOG_ERROR, "Cannot get size of file %s\n", upload_file);
+        ret = EXIT_FAILURE;
+        goto out_upload;
+    }
+    size = (uint32_t)sz;
+    log_printf(LOG_DEBUG, "[upload] new file %s size: %u\n", upload_file,
+               size);
+    rewind(fp);
 
-    buf = malloc(sz);
-    if (!buf) {
-        log_printf(LOG_ERROR, "Not enough memory\n");
+    /* Only an existing NVP file is replaced */
+    nvp_fp = spinorfs_open(nvp_file, diff ? SPINORFS_O_RDWR :
+                                            SPINORFS_O_RDONLY);
+    if (nvp_fp == NULL) {
+        log_printf(LOG_ERROR, "ERROR in open file %s\n", nvp_file);
         ret = EXIT_FAILURE;
         goto out_upload;
     }
-    fseek(fp, 0, SEEK_SET);
-    fread(buf, sz, 1, fp);
-    write_buf = buf;
 
-loop:
-    if (sz >= DEFAULT_PAGE_SIZE)
-        bytes = DEFAULT_PAGE_SIZE;
-    else
-        bytes = sz;
+    ret = upload_check_file(fp, size, nvp_fp, &identical);
+    if (ret != EXIT_SUCCESS) {
+        log_printf(LOG_ERROR, "Invalid NVP file %s\n", upload_file);
+        goto out_nvp;
+    }
+    if (identical) {
+        log_printf(LOG_DEBUG, "NVP file %s unchanged, skip write\n",
+                   nvp_file);
+        goto out_report;
+    }
+    rewind(fp);
 
-    ret = spinorfs_write((char *)write_buf, offset, bytes);
+    if (diff && spinorfs_size(nvp_fp) == (int)size) {
+        ret = upload_diff_write(fp, nvp_fp, size, &programmed);
+        goto out_report;
+    }
+    spinorfs_close(nvp_fp);
+    nvp_fp = NULL;
 
-    if (ret != bytes) {
-        log_printf(LOG_ERROR, "ERROR write to NVP file\n");
+    /* Write the new content next to the NVP file, it stays intact */
+    snprintf(tmp_file, sizeof(tmp_file), "%s%s", nvp_file,
+             UPLOAD_TMP_SUFFIX);
+    nvp_fp = spinorfs_open(tmp_file, SPINORFS_O_WRONLY | SPINORFS_O_CREAT |
+                                     SPINORFS_O_TRUNC);
+    if (nvp_fp == NULL) {
+        log_printf(LOG_ERROR, "ERROR in open file %s\n", tmp_file);
         ret = EXIT_FAILURE;
-    } else {
-        sz -= bytes;
-        write_buf += bytes;
-        offset += bytes;
-        if (sz > 0)
-            goto loop;
-        log_printf(LOG_DEBUG, "DONE write NVP file: %d\n", offset);
+        goto out_upload;
     }
 
-    if (buf)
-        free(buf);
+    for (offset = 0; offset < size; offset += bytes) {
+        bytes = size - offset < sizeof(buff) ? size - offset : sizeof(buff);
+        if (fread(buff, 1, bytes, fp) != bytes ||
+            spinorfs_write(nvp_fp, (char *)buff, offset, bytes) !=
+            (int)bytes) {
+            log_printf(LOG_ERROR, "ERROR write to NVP file\n");
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+    log_printf(LOG_DEBUG, "DONE write NVP file: %u\n", offset);
+    programmed = offset;
 
+    /* Closing the file commits its content before the switch */
+    if (spinorfs_close(nvp_fp) != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    nvp_fp = NULL;
+    if (ret == EXIT_SUCCESS) {
+        ret = spinorfs_rename(tmp_file, nvp_file);
+    }
+    if (ret != EXIT_SUCCESS) {
+        spinorfs_remove(tmp_file);
+        goto out_upload;
+    }
+
+out_report:
+    if (diff && ret == EXIT_SUCCESS) {
+        log_printf(LOG_NORMAL, "Programmed %u of %u bytes\n", programmed,
+                   size);
+    }
+out_nvp:
+    if (nvp_fp) {
+        spinorfs_close(nvp_fp);
+    }
 out_upload:
-    spinorfs_close();
-    if (fp)
-        fclose(fp);
+    fclose(fp);
 
     return ret;
 }
 
 /**
- * @fn operate_field_hdlr
+ * @fn spinor_image_load
  *
- * @brief Operate on specific NVP field and its associated valid bit
- * @param  ctrl [IN] - Input control structure
+ * @brief Read the whole NVP file already opened by spinorfs_open into memory
+ * @param  nvp_fp [IN] - The opened NVP file
+ * @param  img [OUT] - NVP image holding the file content
  * @return  0 - Success
  *          1 - Failure
  **/
-int operate_field_hdlr(nvparm_ctrl_t *ctrl)
+static int spinor_image_load(spinorfs_file_t *nvp_fp, nvp_image_t *img)
 {
-    int ret = EXIT_SUCCESS;
-    struct nvp_header header = {0};
-    uint32_t offset = 0;
-    uint64_t nvp_value = 0;
-    uint8_t nvp_valid = 0;
-    uint8_t *val_bit_arr = NULL;
-    uint8_t val_bit_arr_sz = 0;
-    uint8_t need_update_cs = 0;
-    uint8_t *data_cs = NULL;
-    struct nvp_header *p_nvp_header = NULL;
-
-    if (ctrl->nvp_file == NULL) {
-        return EXIT_FAILURE;
-    }
+    uint8_t *tmp = NULL;
+    uint32_t cap = 0;
+    int byte_cnt = 0;
 
-    /* Open nvp_file */
-    ret = spinorfs_open(ctrl->nvp_file, SPINORFS_O_RDWR);
-    if (ret < 0) {
-        log_printf(LOG_ERROR, "ERROR %d in open file %s\n",
-                   ret, ctrl->nvp_file);
-        return EXIT_FAILURE;
-    }
-    /* Read NVP header at start of the file */
-    offset = 0;
-    ret = spinorfs_read((char *)&header, offset, sizeof(header));
-    if (ret != (int)sizeof(header)) {
-        log_printf(LOG_ERROR, "ERROR in read NVP header\n");
-        spinorfs_close();
-        return EXIT_FAILURE;
+    memset(img, 0, sizeof(*img));
+    do {
+        if (img->size == cap) {
+            cap += DEFAULT_PAGE_SIZE;
+            tmp = (uint8_t *)realloc(img->data, cap);
+            if (tmp == NULL) {
+                log_printf(LOG_ERROR, "Can't allocate memory\n");
+                nvp_image_free(img);
+                return EXIT_FAILURE;
+            }
+            img->data = tmp;
+        }
+        byte_cnt = spinorfs_read(nvp_fp, (char *)img->data + img->size,
+                                 img->size, cap - img->size);
+        if (byte_cnt < 0) {
+            nvp_image_free(img);
+            return EXIT_FAILURE;
+        }
+        img->size += byte_cnt;
+    } while (byte_cnt > 0);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn spinor_image_commit
+ *
+ * @brief Write the modified range of the NVP image back to the opened file
+ *        with a single write
+ * @param  nvp_fp [IN] - The opened NVP file
+ * @param  img [IN/OUT] - NVP image
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int spinor_image_commit(spinorfs_file_t *nvp_fp, nvp_image_t *img)
+{
+    uint32_t size = img->dirty_end - img->dirty_start;
+    int ret = 0;
+
+    if (img->dirty_end == 0) {
+        return EXIT_SUCCESS;
     }
-    if (ctrl->field_index >= header.count) {
-        log_printf(LOG_ERROR, "Invalid NVP field index\n");
-        spinorfs_close();
+    ret = spinorfs_write(nvp_fp, (char *)img->data + img->dirty_start,
+                         img->dirty_start, size);
+    if (ret != (int)size) {
+        log_printf(LOG_ERROR, "ERROR in write NVP file\n");
         return EXIT_FAILURE;
     }
+    img->dirty_start = 0;
+    img->dirty_end = 0;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn nvp_field_op
+ *
+ * @brief Operate on specific NVP field and its associated valid bit of the
+ *        NVP file already opened by spinorfs_open
+ * @param  nvp_fp [IN] - The opened NVP file
+ * @param  ctrl [IN] - Input control structure
+ * @param  field [OUT] - Field data and valid bit read by option -r
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int nvp_field_op(spinorfs_file_t *nvp_fp, nvparm_ctrl_t *ctrl,
+                        struct nvp_field *field)
+{
+    int ret = EXIT_SUCCESS;
+    nvp_image_t img;
 
-    /* Calculate size of nvp valid bit array */
-    val_bit_arr_sz = header.count / NVP_VAL_BIT_PER_ELE +
-                     ((header.count % NVP_VAL_BIT_PER_ELE) ? 1 : 0);
-    val_bit_arr = (uint8_t *)malloc(val_bit_arr_sz);
-    if (val_bit_arr == NULL) {
-        log_printf(LOG_ERROR, "Can't allocate memory\n");
-        spinorfs_close();
+    ret = spinor_image_load(nvp_fp, &img);
+    if (ret != EXIT_SUCCESS) {
         return EXIT_FAILURE;
     }
-    memset(val_bit_arr, 0, val_bit_arr_sz);
+    ret = nvp_image_apply(&img, ctrl, field);
+    if (ret == EXIT_SUCCESS) {
+        ret = spinor_image_commit(nvp_fp, &img);
+    }
+    nvp_image_free(&img);
 
-    /* Calculate offset of nvp valid bit array */
-    offset = sizeof(header);
-    ret = spinorfs_read((char *)val_bit_arr, offset, val_bit_arr_sz);
-    if (ret != (int)val_bit_arr_sz) {
-        log_printf(LOG_ERROR, "ERROR in read NVP valid bit array\n");
-        free(val_bit_arr);
-        spinorfs_close();
+    return ret;
+}
+
+/**
+ * @fn spinor_field_hdlr
+ *
+ * @brief Operate on specific NVP field of the mounted partition
+ * @param  ctrl [IN] - Input control structure
+ * @param  field [OUT] - Field data and valid bit read by option -r
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinor_field_hdlr(nvparm_ctrl_t *ctrl, struct nvp_field *field)
+{
+    int ret = EXIT_SUCCESS;
+    spinorfs_file_t *nvp_fp = NULL;
+
+    /* Open nvp_file, a read works on a read-only mount */
+    nvp_fp = spinorfs_open(ctrl->nvp_file, ctrl->options[OPTION_R] ?
+                           SPINORFS_O_RDONLY : SPINORFS_O_RDWR);
+    if (nvp_fp == NULL) {
+        log_printf(LOG_ERROR, "ERROR in open file %s\n", ctrl->nvp_file);
         return EXIT_FAILURE;
     }
 
-    #ifdef DEBUG
-    log_printf(LOG_DEBUG, "Valid bit array value:");
-    for (int i = 0; i < val_bit_arr_sz; i++) {
-        log_printf(LOG_DEBUG, " 0x%.2x", val_bit_arr[i]);
-    }
-    log_printf(LOG_DEBUG, "\n");
-    log_printf(LOG_DEBUG, "NVP HEADER:\n");
-    log_printf(LOG_DEBUG, "field_size: %d, flags:%d, count:%d, data_offset:%d\n",
-    header.field_size, header.flags, header.count, header.data_offset);
-    #endif
-
-    if (ctrl->options[OPTION_R]) {
-        /* Calculate offset of nvp field */
-        offset = header.data_offset +
-                 ctrl->field_index * header.field_size;
-        ret = spinorfs_read((char *)&nvp_value, offset, header.field_size);
-        if (ret != (int)header.field_size) {
-            log_printf(LOG_ERROR, "ERROR in read NVP field\n");
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-
-        /* Get the bit of nvp field index */
-        nvp_valid = UINT8_GET_BIT(val_bit_arr, ctrl->field_index);
-        if (header.field_size == NVP_FIELD_SIZE_1) {
-            log_printf(LOG_NORMAL, "0x%.2x 0x%.2x\n",
-                       nvp_valid, (uint8_t)nvp_value);
-        } else if (header.field_size == NVP_FIELD_SIZE_4) {
-            log_printf(LOG_NORMAL, "0x%.2x 0x%.8x\n",
-                       nvp_valid, (uint32_t)nvp_value);
-        } else if (header.field_size == NVP_FIELD_SIZE_8) {
-            log_printf(LOG_NORMAL, "0x%.2x 0x%.16llx\n",
-                       nvp_valid, nvp_value);
-        } else {
-            log_printf(LOG_ERROR, "Unsupported field size: %d\n",
-                       header.field_size);
-        }
-    } else if (ctrl->options[OPTION_W]) {
-        ret = UINT64_VALIDATE_NVP(header.field_size, ctrl->nvp_data);
-        if (ret != EXIT_SUCCESS) {
-            log_printf(LOG_ERROR,
-                       "NVP data exceeds MAX value of field size %d bytes\n",
-                       header.field_size);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
+    ret = nvp_field_op(nvp_fp, ctrl, field);
+    spinorfs_close(nvp_fp);
 
-        offset = header.data_offset + ctrl->field_index * header.field_size;
-        ret = spinorfs_write((char *)&(ctrl->nvp_data), offset, header.field_size);
-        if (ret != (int)header.field_size) {
-            log_printf(LOG_ERROR, "ERROR in write NVP field: %d\n",
-                       ctrl->field_index);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
+    return ret;
+}
 
-        /* Update valid bit */
-        if (ctrl->options[OPTION_V]) {
-            if (ctrl->valid_bit == NVP_FIELD_IGNORE) {
-                UINT8_CLEAR_BIT(val_bit_arr, ctrl->field_index);
-            } else if (ctrl->valid_bit == NVP_FIELD_SET) {
-                UINT8_SET_BIT(val_bit_arr, ctrl->field_index);
-            } else {
-                log_printf(LOG_ERROR, "Unsupported valid bit value: 0x%.2x\n",
-                           ctrl->valid_bit);
-                free(val_bit_arr);
-                spinorfs_close();
-                return EXIT_FAILURE;
-            }
-        } else {
-            /* Set the nvp field by default */
-            UINT8_SET_BIT(val_bit_arr, ctrl->field_index);
-        }
-        offset = sizeof(header);
-        ret = spinorfs_write((char *)val_bit_arr, offset, val_bit_arr_sz);
-        if (ret != (int)val_bit_arr_sz) {
-            log_printf(LOG_ERROR, "ERROR in write NVP valid field: %d\n",
-                       ctrl->field_index);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-        if (header.flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) {
-            need_update_cs = 1;
-        }
-    } else if (ctrl->options[OPTION_V]) {
-        if (ctrl->valid_bit == NVP_FIELD_IGNORE) {
-            UINT8_CLEAR_BIT(val_bit_arr, ctrl->field_index);
-        } else if (ctrl->valid_bit == NVP_FIELD_SET) {
-            UINT8_SET_BIT(val_bit_arr, ctrl->field_index);
-        } else {
-            log_printf(LOG_ERROR, "Unsupported valid bit value: 0x%.2x\n",
-                       ctrl->valid_bit);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-        offset = sizeof(header);
-        ret = spinorfs_write((char *)val_bit_arr, offset, val_bit_arr_sz);
-        if (ret != (int)val_bit_arr_sz) {
-            log_printf(LOG_ERROR, "ERROR in write NVP valid field: %d\n",
-                       ctrl->field_index);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-        if (header.flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) {
-            need_update_cs = 1;
-        }
-    } else if (ctrl->options[OPTION_E]) {
-        /* Erase NVP field by set its all data to 1 */
-        nvp_value = ULLONG_MAX;
-        offset = header.data_offset + ctrl->field_index * header.field_size;
-        ret = spinorfs_write((char *)&(nvp_value), offset, header.field_size);
-        if (ret != (int)header.field_size) {
-            log_printf(LOG_ERROR, "ERROR in write NVP field: %d\n",
-                       ctrl->field_index);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
+/**
+ * @fn operate_field_hdlr
+ *
+ * @brief Operate on specific NVP field and its associated valid bit
+ * @param  ctrl [IN] - Input control structure
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int operate_field_hdlr(nvparm_ctrl_t *ctrl)
+{
+    int ret = EXIT_SUCCESS;
+    struct nvp_field field = {0};
 
-        /* Set the associated valid bit of NVP field to 0 */
-        UINT8_CLEAR_BIT(val_bit_arr, ctrl->field_index);
-        offset = sizeof(header);
-        ret = spinorfs_write((char *)val_bit_arr, offset, val_bit_arr_sz);
-        if (ret != (int)val_bit_arr_sz) {
-            log_printf(LOG_ERROR, "ERROR in write NVP valid field: %d\n",
-                       ctrl->field_index);
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-        if (header.flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) {
-            need_update_cs = 1;
-        }
-    }
-    #ifdef DEBUG
-    log_printf(LOG_DEBUG, "Valid bit array value after update:");
-    for (int i = 0; i < val_bit_arr_sz; i++) {
-        log_printf(LOG_DEBUG, " 0x%.2x", val_bit_arr[i]);
-    }
-    log_printf(LOG_DEBUG, "\n");
-    #endif
-    if (need_update_cs) {
-        /* Read all NVP data */
-        data_cs = (uint8_t *)malloc (header.length);
-        if (data_cs == NULL) {
-            log_printf(LOG_ERROR, "Can't allocate memory\n");
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-        ret = spinorfs_read((char *)data_cs, 0, header.length);
-        if (ret != (int)header.length) {
-            log_printf(LOG_ERROR, "ERROR in read NVP blobs\n");
-            free(val_bit_arr);
-            free(data_cs);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
-        /* Clear current checksum */
-        p_nvp_header = (struct nvp_header *) data_cs;
-        p_nvp_header->checksum = 0;
-
-        header.checksum = calculate_sum8(data_cs, header.length);
-        log_printf(LOG_DEBUG, "New checksum: 0x%x\n", header.checksum);
-        free(data_cs);
-
-        /* Write checksum to file */
-        ret = spinorfs_write((char *)&header, 0, sizeof (header));
-        if (ret != (int)sizeof (header)) {
-            log_printf(LOG_ERROR, "ERROR in write NVP blobs\n");
-            free(val_bit_arr);
-            spinorfs_close();
-            return EXIT_FAILURE;
-        }
+    ret = spinor_field_hdlr(ctrl, &field);
+    if (ret == EXIT_SUCCESS && ctrl->options[OPTION_R]) {
+        print_nvp_field(&field);
     }
+    return ret;
+}
 
-    free(val_bit_arr);
-    spinorfs_close();
+/**
+ * @fn spinor_load_nvp
+ *
+ * @brief Read the whole NVP file of the mounted partition into memory
+ * @param  nvp_file [IN] - NVPARAM file to be read
+ * @param  data [OUT] - Allocated buffer holding the file, freed by caller
+ * @param  len [OUT] - Size of the file in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinor_load_nvp(char *nvp_file, uint8_t **data, uint32_t *len)
+{
+    int ret = EXIT_SUCCESS;
+    nvp_image_t img;
+    spinorfs_file_t *nvp_fp = NULL;
 
+    nvp_fp = spinorfs_open(nvp_file, SPINORFS_O_RDONLY);
+    if (nvp_fp == NULL) {
+        log_printf(LOG_ERROR, "ERROR in open file %s\n", nvp_file);
+        return EXIT_FAILURE;
+    }
+    ret = spinor_image_load(nvp_fp, &img);
+    spinorfs_close(nvp_fp);
+    if (ret != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    *data = img.data;
+    *len = img.size;
     return EXIT_SUCCESS;
 }
 
+/**
+ * @fn spinor_read_only
+ *
+ * @brief Check if the operation only reads the flash: read a field (-r),
+ *        dump an NVP file (-d) or print the GPT (-p)
+ * @param  ctrl [IN] - The nvparam controller structure
+ * @return  1 - Read only operation
+ *          0 - Otherwise
+ **/
+static int spinor_read_only(nvparm_ctrl_t *ctrl)
+{
+    if (ctrl->options[OPTION_W] || ctrl->options[OPTION_V] ||
+        ctrl->options[OPTION_E] || ctrl->options[OPTION_O]) {
+        return 0;
+    }
+    return ctrl->options[OPTION_R] || ctrl->options[OPTION_D] ||
+           ctrl->options[OPTION_P];
+}
+
 /**
  * @fn spinor_handler
  *
@@ -508,9 +815,13 @@ int spinor_handler (nvparm_ctrl_t *ctrl)
     int ret = EXIT_SUCCESS;
     uint32_t size = 0, offset = 0;
     int dev_fd = -1;
+    struct spinorfs_mount_opts opts = {0};
+
+    /* Reads never format the partition nor open the device to write */
+    opts.read_only = spinor_read_only(ctrl);
 
     /* Finding the MTD partition for host SPI chip */
-    ret = find_host_mtd_partition(ctrl, &dev_fd);
+    ret = find_host_mtd_partition(ctrl, opts.read_only, &dev_fd);
     if (ret != EXIT_SUCCESS) {
         return ret;
     }
@@ -519,23 +830,21 @@ int spinor_handler (nvparm_ctrl_t *ctrl)
     if (ctrl->options[OPTION_P]) {
         ret = spinorfs_gpt_disk_info(dev_fd, SHOW_GPT_ENABLE);
         goto out_dev;
-    } else {
-        ret = spinorfs_gpt_disk_info(dev_fd, SHOW_GPT_DISABLE);
-        if (ret != EXIT_SUCCESS) {
-            ret = EXIT_FAILURE;
-            goto out_dev;
-        }
     }
 
-    /* Verify input partition name/GUID to get offset + size before mount */
+    /*
+     * Verify input partition name/GUID to get offset + size before mount.
+     * The partition table comes from the GPT cache when it is enabled,
+     * otherwise the GPT scan stops at the matching entry.
+     */
     if (ctrl->options[OPTION_T]) {
-        ret = spinorfs_gpt_part_name_info(ctrl->nvp_part, &offset, &size);
+        ret = spinorfs_gpt_find_name(dev_fd, ctrl->nvp_part, &offset, &size);
         if (ret != EXIT_SUCCESS) {
             ret = EXIT_FAILURE;
             goto out_dev;
         }
     } else if (ctrl->options[OPTION_U]) {
-        ret = spinorfs_gpt_part_guid_info(ctrl->nvp_guid, &offset, &size);
+        ret = spinorfs_gpt_find_guid(dev_fd, ctrl->nvp_guid, &offset, &size);
         if (ret != EXIT_SUCCESS) {
             ret = EXIT_FAILURE;
             goto out_dev;
@@ -546,19 +855,21 @@ int spinor_handler (nvparm_ctrl_t *ctrl)
     }
 
     /* Mount partition */
-    ret = spinorfs_mount(dev_fd, size, offset);
+    ret = spinorfs_mount_with_opts(dev_fd, size, offset, &opts);
     if (ret != EXIT_SUCCESS) {
         goto out_dev;
     }
     /* Dump nvp file */
     if (ctrl->options[OPTION_D]) {
         /* Find the file in mounted partition */
-        ret = dump_nvp_hdlr(ctrl->nvp_file, ctrl->dump_file);
+        ret = dump_nvp_hdlr(ctrl->nvp_file, ctrl->dump_file,
+                            dump_chunk_size(ctrl, dev_fd));
         goto out_unmount;
     }
     /* Upload/overwrite nvp file */
     if (ctrl->options[OPTION_O]) {
-        ret = upload_nvp_hdlr(ctrl->nvp_file, ctrl->upload_file);
+        ret = upload_nvp_hdlr(ctrl->nvp_file, ctrl->upload_file,
+                              ctrl->options[OPTION_DIFF]);
         goto out_unmount;
     }
     /* Operate on nvp field */
@@ -574,4 +885,292 @@ out_dev:
         close(dev_fd);
     }
     return ret;
+}
+
+/**
+ * @fn spinor_session_open
+ *
+ * @brief Open the host SPI NOR device and parse its GPT once for several
+ *        operations
+ * @param  ctrl [IN] - The nvparam controller structure (device selection)
+ * @param  sess [OUT] - The session to be initialized
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinor_session_open(nvparm_ctrl_t *ctrl, spinor_session_t *sess)
+{
+    int ret = EXIT_SUCCESS;
+
+    memset(sess, 0, sizeof(*sess));
+    sess->dev_fd = -1;
+
+    /* Finding the MTD partition for host SPI chip */
+    ret = find_host_mtd_partition(ctrl, 0, &sess->dev_fd);
+    if (ret != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    ret = spinorfs_gpt_disk_info(sess->dev_fd, SHOW_GPT_DISABLE);
+    if (ret != EXIT_SUCCESS) {
+        close(sess->dev_fd);
+        sess->dev_fd = -1;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn spinor_session_mounted
+ *
+ * @brief Check if the partition of an operation is the mounted one
+ * @param  sess [IN] - The SPI NOR session
+ * @param  ctrl [IN] - Control structure of the operation
+ * @return  1 - Partition already mounted
+ *          0 - Otherwise
+ **/
+static int spinor_session_mounted(spinor_session_t *sess, nvparm_ctrl_t *ctrl)
+{
+    if (!sess->mounted || sess->use_guid != ctrl->options[OPTION_U]) {
+        return 0;
+    }
+    if (sess->use_guid) {
+        return memcmp(sess->nvp_guid, ctrl->nvp_guid, GUID_BYTE_SIZE) == 0;
+    }
+    return strcmp(sess->nvp_part, ctrl->nvp_part) == 0;
+}
+
+/**
+ * @fn same_partition
+ *
+ * @brief Check if two operations target the same partition
+ * @param  a [IN] - Control structure of the first operation
+ * @param  b [IN] - Control structure of the second operation
+ * @return  1 - Same partition
+ *          0 - Different partitions
+ **/
+static int same_partition(nvparm_ctrl_t *a, nvparm_ctrl_t *b)
+{
+    if (a->options[OPTION_U] != b->options[OPTION_U]) {
+        return 0;
+    }
+    if (a->options[OPTION_U]) {
+        return memcmp(a->nvp_guid, b->nvp_guid, GUID_BYTE_SIZE) == 0;
+    }
+    return strcmp(a->nvp_part, b->nvp_part) == 0;
+}
+
+/**
+ * @fn spinor_session_mount
+ *
+ * @brief Mount the partition of an operation unless it is already mounted
+ * @param  sess [IN/OUT] - The SPI NOR session
+ * @param  ctrl [IN] - Control structure of the operation
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinor_session_mount(spinor_session_t *sess, nvparm_ctrl_t *ctrl)
+{
+    int ret = EXIT_SUCCESS;
+    uint32_t size = 0, offset = 0;
+
+    if (spinor_session_mounted(sess, ctrl)) {
+        return EXIT_SUCCESS;
+    }
+    spinor_session_unmount(sess);
+
+    if (ctrl->options[OPTION_U]) {
+        ret = spinorfs_gpt_part_guid_info(ctrl->nvp_guid, &offset, &size);
+    } else {
+        ret = spinorfs_gpt_part_name_info(ctrl->nvp_part, &offset, &size);
+    }
+    if (ret != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    ret = spinorfs_mount(sess->dev_fd, size, offset);
+    if (ret != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    sess->mounted = 1;
+    sess->use_guid = ctrl->options[OPTION_U];
+    memcpy(sess->nvp_guid, ctrl->nvp_guid, GUID_BYTE_SIZE);
+    strncpy(sess->nvp_part, ctrl->nvp_part, sizeof(sess->nvp_part));
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn spinor_session_unmount
+ *
+ * @brief Unmount the partition mounted by the session, if any
+ * @param  sess [IN/OUT] - The SPI NOR session
+ **/
+void spinor_session_unmount(spinor_session_t *sess)
+{
+    if (sess->mounted) {
+        spinorfs_unmount();
+        sess->mounted = 0;
+    }
+}
+
+/**
+ * @fn spinor_session_lock
+ *
+ * @brief Lock the device of the session for the operations to come,
+ *        waiting for the other writer of the device to finish
+ * @param  sess [IN] - The SPI NOR session
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinor_session_lock(spinor_session_t *sess)
+{
+    return flock_device(sess->dev_fd, "MTD device");
+}
+
+/**
+ * @fn spinor_session_unlock
+ *
+ * @brief Unmount the partition then unlock the device of the session. The
+ *        littlefs state and cached blocks are dropped since another process
+ *        may write the device once it is unlocked.
+ * @param  sess [IN/OUT] - The SPI NOR session
+ **/
+void spinor_session_unlock(spinor_session_t *sess)
+{
+    spinor_session_unmount(sess);
+    flock(sess->dev_fd, LOCK_UN);
+}
+
+/**
+ * @fn spinor_session_close
+ *
+ * @brief Unmount the partition and close the device of the session
+ * @param  sess [IN/OUT] - The SPI NOR session
+ **/
+void spinor_session_close(spinor_session_t *sess)
+{
+    spinor_session_unmount(sess);
+    if (sess->dev_fd != -1) {
+        close(sess->dev_fd);
+        sess->dev_fd = -1;
+    }
+}
+
+/**
+ * @fn batch_close_file
+ *
+ * @brief Write back the NVP image of the batch file group and close it.
+ *        Operations of the group are failed if the write back fails.
+ * @param  ops [IN/OUT] - Sorted batch operations
+ * @param  first [IN] - Index of the first operation of the group
+ * @param  last [IN] - Index after the last operation of the group
+ * @param  nvp_fp [IN] - The opened NVP file, closed
+ * @param  img [IN/OUT] - NVP image of the file
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int batch_close_file(nvp_batch_op_t **ops, int first, int last,
+                            spinorfs_file_t *nvp_fp, nvp_image_t *img)
+{
+    int ret = spinor_image_commit(nvp_fp, img);
+
+    if (ret != EXIT_SUCCESS) {
+        for (int i = first; i < last; i++) {
+            if (!ops[i]->ctrl.options[OPTION_R]) {
+                ops[i]->status = EXIT_FAILURE;
+            }
+        }
+    }
+    nvp_image_free(img);
+    spinorfs_close(nvp_fp);
+    return ret;
+}
+
+/**
+ * @fn spinor_batch_handler
+ *
+ * @brief Run the batch field operations on SPI NOR flash. The operations
+ *        must be sorted by partition then by NVP file so that each
+ *        partition is mounted once and each NVP file is read once into
+ *        memory then written back once.
+ * @param  ctrl [IN] - The nvparam controller structure (device selection)
+ * @param  ops [IN/OUT] - Sorted batch operations, status and field updated
+ * @param  count [IN] - Number of batch operations
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int spinor_batch_handler (nvparm_ctrl_t *ctrl, nvp_batch_op_t **ops,
+                          int count)
+{
+    int ret = EXIT_SUCCESS;
+    spinor_session_t sess;
+    nvparm_ctrl_t *part = NULL, *opened = NULL;
+    int mount_ret = EXIT_FAILURE, open_ret = EXIT_FAILURE;
+    int first = 0;
+    nvp_image_t img;
+    spinorfs_file_t *nvp_fp = NULL;
+
+    ret = spinor_session_open(ctrl, &sess);
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    for (int i = 0; i < count; i++) {
+        nvparm_ctrl_t *op = &ops[i]->ctrl;
+        int new_part = (part == NULL || !same_partition(part, op));
+
+        /* Close the previous NVP file at the end of its group */
+        if (opened != NULL &&
+            (new_part || strcmp(opened->nvp_file, op->nvp_file) != 0)) {
+            if (open_ret == EXIT_SUCCESS &&
+                batch_close_file(ops, first, i, nvp_fp, &img) != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+            }
+            opened = NULL;
+        }
+
+        /* Mount each partition once */
+        if (new_part) {
+            part = op;
+            mount_ret = spinor_session_mount(&sess, op);
+        }
+        if (mount_ret != EXIT_SUCCESS) {
+            ops[i]->status = EXIT_FAILURE;
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        /* Load each NVP file once */
+        if (opened == NULL) {
+            opened = op;
+            first = i;
+            open_ret = EXIT_FAILURE;
+            nvp_fp = spinorfs_open(op->nvp_file, SPINORFS_O_RDWR);
+            if (nvp_fp == NULL) {
+                log_printf(LOG_ERROR, "ERROR in open file %s\n",
+                           op->nvp_file);
+            } else {
+                open_ret = spinor_image_load(nvp_fp, &img);
+                if (open_ret != EXIT_SUCCESS) {
+                    spinorfs_close(nvp_fp);
+                }
+            }
+        }
+        if (open_ret != EXIT_SUCCESS) {
+            ops[i]->status = EXIT_FAILURE;
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        ops[i]->status = nvp_image_apply(&img, op, &ops[i]->field);
+        if (ops[i]->status != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (opened != NULL && open_ret == EXIT_SUCCESS &&
+        batch_close_file(ops, first, count, nvp_fp, &img) != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    spinor_session_close(&sess);
+    return ret;
 }
\ No newline at end of file
@@ -15,12 +15,38 @@
 #define _HOSTFW_NVP_H_
 
 #include "utils.h"
+#include "nvp_batch.h"
 
 #define PROC_MTD_INFO               "/proc/mtd"
 #define HOST_SPI_FLASH_MTD_NAME     "hnor"
 #define MTD_DEV_SIZE                20
 #define DEFAULT_PAGE_SIZE           4096
+/* Changed ranges of a differential upload closer than this are merged */
+#define UPLOAD_DIFF_GAP             16
+/* Suffix of the temporary file written by an upload before the rename */
+#define UPLOAD_TMP_SUFFIX           ".tmp"
 
+/* Host SPI NOR device kept open across several operations */
+typedef struct spinor_session {
+    int dev_fd;                         // MTD device file descriptor
+    uint8_t mounted;                    // A partition is mounted
+    uint8_t use_guid;                   // Mounted partition selected by GUID
+    char nvp_part[MAX_PART_NAME_LEN];   // Name of the mounted partition
+    uint8_t nvp_guid[GUID_BYTE_SIZE];   // GUID of the mounted partition
+} spinor_session_t;
+
+extern int find_host_mtd_device (nvparm_ctrl_t *ctrl, char *mtd_dev,
+                                size_t len);
 extern int spinor_handler (nvparm_ctrl_t *ctrl);
+extern int spinor_session_open(nvparm_ctrl_t *ctrl, spinor_session_t *sess);
+extern int spinor_session_mount(spinor_session_t *sess, nvparm_ctrl_t *ctrl);
+extern void spinor_session_unmount(spinor_session_t *sess);
+extern int spinor_session_lock(spinor_session_t *sess);
+extern void spinor_session_unlock(spinor_session_t *sess);
+extern void spinor_session_close(spinor_session_t *sess);
+extern int spinor_field_hdlr(nvparm_ctrl_t *ctrl, struct nvp_field *field);
+extern int spinor_load_nvp(char *nvp_file, uint8_t **data, uint32_t *len);
+extern int spinor_batch_handler (nvparm_ctrl_t *ctrl, nvp_batch_op_t **ops,
+                                 int count);
 
 #endif  /* _HOSTFW_NVP_H_ */
\ No newline at end of file
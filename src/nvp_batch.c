@@ -0,0 +1,338 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Batch mode runs many field operations in one GPT scan. Each line of the
+ * batch script describes one operation:
+ *   <nvp_part|nvp_guid> <nvp_file> <field_index> r
+ *   <nvp_part|nvp_guid> <nvp_file> <field_index> w <nvp_data> [<valid_bit>]
+ *   <nvp_part|nvp_guid> <nvp_file> <field_index> v <valid_bit>
+ *   <nvp_part|nvp_guid> <nvp_file> <field_index> e
+ * Empty lines and text after '#' are ignored.
+ **/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "nvp_batch.h"
+#include "hostfw_nvp.h"
+#include "bsd_eeprom_nvp.h"
+
+/**
+ * @fn parse_number
+ *
+ * @brief Convert a batch token to number.
+ * @param  str [IN] - The token to be converted
+ * @param  base [IN] - Base of the number
+ * @param  max [IN] - Maximum allowed value
+ * @param  num [OUT] - Converted number
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int parse_number(char *str, int base, unsigned long long max,
+                        unsigned long long *num)
+{
+    char *endptr = NULL;
+
+    errno = 0;
+    *num = strtoull(str, &endptr, base);
+    if (str == endptr || errno == ERANGE || *endptr || *num > max) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn parse_batch_line
+ *
+ * @brief Parse one line of the batch script into a field operation.
+ * @param  line [IN] - Text of the line, modified by tokenizing
+ * @param  op [OUT] - The parsed operation
+ * @return  0 - Success
+ *          1 - Failure
+ *         -1 - Nothing to do (empty or comment line)
+ **/
+static int parse_batch_line(char *line, nvp_batch_op_t *op)
+{
+    char *tok[BATCH_MAX_TOKENS] = {0};
+    char *comment = NULL;
+    int ntok = 0, nargs = 0;
+    unsigned long long num = 0;
+    nvparm_ctrl_t *ctrl = &op->ctrl;
+
+    comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+    for (char *p = strtok(line, " \t\r\n"); p != NULL;
+         p = strtok(NULL, " \t\r\n")) {
+        if (ntok == BATCH_MAX_TOKENS) {
+            log_printf(LOG_ERROR, "line %d: too many arguments\n", op->line);
+            return EXIT_FAILURE;
+        }
+        tok[ntok++] = p;
+    }
+    if (ntok == 0) {
+        return -1;
+    }
+    if (ntok < 4 || strlen(tok[3]) != 1) {
+        log_printf(LOG_ERROR, "line %d: expected <nvp_part|nvp_guid>"
+                   " <nvp_file> <field_index> <r|w|v|e> [args]\n", op->line);
+        return EXIT_FAILURE;
+    }
+
+    /* Partition name or GUID */
+    if (strcmp(tok[0], BSD_PARTITION_NAME) == 0 || strcmp(tok[0], "0") == 0) {
+        log_printf(LOG_ERROR, "line %d: BSD EEPROM is not supported in batch"
+                   " mode\n", op->line);
+        return EXIT_FAILURE;
+    }
+    if (guid_str2int(tok[0], ctrl->nvp_guid) == EXIT_SUCCESS) {
+        ctrl->options[OPTION_U] = 1;
+    } else if (strlen(tok[0]) < MAX_PART_NAME_LEN) {
+        ctrl->options[OPTION_T] = 1;
+        strncpy(ctrl->nvp_part, tok[0], sizeof(ctrl->nvp_part) - 1);
+    } else {
+        log_printf(LOG_ERROR, "line %d: partition name is too long\n",
+                   op->line);
+        return EXIT_FAILURE;
+    }
+
+    /* NVP file */
+    if (strlen(tok[1]) >= MAX_NAME_LENGTH) {
+        log_printf(LOG_ERROR, "line %d: nvp file name is too long\n",
+                   op->line);
+        return EXIT_FAILURE;
+    }
+    ctrl->options[OPTION_F] = 1;
+    strncpy(ctrl->nvp_file, tok[1], sizeof(ctrl->nvp_file) - 1);
+
+    /* Field index */
+    if (parse_number(tok[2], 10, UINT16_MAX, &num) != EXIT_SUCCESS) {
+        log_printf(LOG_ERROR, "line %d: invalid field index %s\n",
+                   op->line, tok[2]);
+        return EXIT_FAILURE;
+    }
+    ctrl->options[OPTION_I] = 1;
+    ctrl->field_index = (uint16_t)num;
+
+    /* Operation and its arguments */
+    nargs = ntok - 4;
+    switch (tok[3][0]) {
+    case 'r':
+        ctrl->options[OPTION_R] = 1;
+        break;
+    case 'e':
+        ctrl->options[OPTION_E] = 1;
+        break;
+    case 'w':
+        if (nargs < 1 || nargs > 2 ||
+            parse_number(tok[4], 16, ULLONG_MAX, &num) != EXIT_SUCCESS) {
+            log_printf(LOG_ERROR, "line %d: expected w <nvp_data>"
+                       " [<valid_bit>]\n", op->line);
+            return EXIT_FAILURE;
+        }
+        ctrl->options[OPTION_W] = 1;
+        ctrl->nvp_data = (uint64_t)num;
+        if (nargs == 2) {
+            if (parse_number(tok[5], 16, UINT8_MAX, &num) != EXIT_SUCCESS) {
+                log_printf(LOG_ERROR, "line %d: invalid valid bit %s\n",
+                           op->line, tok[5]);
+                return EXIT_FAILURE;
+            }
+            ctrl->options[OPTION_V] = 1;
+            ctrl->valid_bit = (uint8_t)num;
+        }
+        nargs = 0;
+        break;
+    case 'v':
+        if (nargs != 1 ||
+            parse_number(tok[4], 16, UINT8_MAX, &num) != EXIT_SUCCESS) {
+            log_printf(LOG_ERROR, "line %d: expected v <valid_bit>\n",
+                       op->line);
+            return EXIT_FAILURE;
+        }
+        ctrl->options[OPTION_V] = 1;
+        ctrl->valid_bit = (uint8_t)num;
+        nargs = 0;
+        break;
+    default:
+        log_printf(LOG_ERROR, "line %d: unknown operation %s\n",
+                   op->line, tok[3]);
+        return EXIT_FAILURE;
+    }
+    if (nargs != 0) {
+        log_printf(LOG_ERROR, "line %d: too many arguments\n", op->line);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn compare_batch_op
+ *
+ * @brief qsort() callback ordering operations by partition, NVP file then
+ *        line number so each group keeps the order of the script.
+ **/
+static int compare_batch_op(const void *a, const void *b)
+{
+    const nvp_batch_op_t *op_a = *(const nvp_batch_op_t * const *)a;
+    const nvp_batch_op_t *op_b = *(const nvp_batch_op_t * const *)b;
+    int cmp = 0;
+
+    cmp = (int)op_a->ctrl.options[OPTION_U] - (int)op_b->ctrl.options[OPTION_U];
+    if (cmp == 0) {
+        if (op_a->ctrl.options[OPTION_U]) {
+            cmp = memcmp(op_a->ctrl.nvp_guid, op_b->ctrl.nvp_guid,
+                         GUID_BYTE_SIZE);
+        } else {
+            cmp = strcmp(op_a->ctrl.nvp_part, op_b->ctrl.nvp_part);
+        }
+    }
+    if (cmp == 0) {
+        cmp = strcmp(op_a->ctrl.nvp_file, op_b->ctrl.nvp_file);
+    }
+    if (cmp == 0) {
+        cmp = op_a->line - op_b->line;
+    }
+    return cmp;
+}
+
+/**
+ * @fn load_batch_script
+ *
+ * @brief Parse all operations of the batch script.
+ * @param  ctrl [IN] - NVPARAM controller struct
+ * @param  ops [OUT] - Allocated array of parsed operations
+ * @param  count [OUT] - Number of parsed operations
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int load_batch_script(nvparm_ctrl_t *ctrl, nvp_batch_op_t **ops,
+                             int *count)
+{
+    int ret = EXIT_SUCCESS;
+    FILE *fp = NULL;
+    char line[BATCH_LINE_LEN];
+    nvp_batch_op_t *list = NULL, *tmp = NULL;
+    int num = 0, cap = 0, line_num = 0, parse_ret = 0;
+
+    if (strcmp(ctrl->batch_file, BATCH_STDIN) == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(ctrl->batch_file, "r");
+        if (fp == NULL) {
+            log_printf(LOG_ERROR, "Cannot open file %s\n", ctrl->batch_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_num++;
+        if (strchr(line, '\n') == NULL && !feof(fp)) {
+            log_printf(LOG_ERROR, "line %d: line is too long\n", line_num);
+            ret = EXIT_FAILURE;
+            break;
+        }
+        if (num == cap) {
+            cap = cap ? cap * 2 : 64;
+            tmp = (nvp_batch_op_t *)realloc(list, cap * sizeof(*list));
+            if (tmp == NULL) {
+                log_printf(LOG_ERROR, "Can't allocate memory\n");
+                ret = EXIT_FAILURE;
+                break;
+            }
+            list = tmp;
+        }
+        memset(&list[num], 0, sizeof(list[num]));
+        list[num].line = line_num;
+        list[num].status = EXIT_FAILURE;
+        /* The device selection applies to all operations */
+        list[num].ctrl.device = SPINOR;
+        list[num].ctrl.options[OPTION_VERIFY_CS] =
+            ctrl->options[OPTION_VERIFY_CS];
+        parse_ret = parse_batch_line(line, &list[num]);
+        if (parse_ret == EXIT_SUCCESS) {
+            num++;
+        } else if (parse_ret == EXIT_FAILURE) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    if (ferror(fp)) {
+        log_printf(LOG_ERROR, "ERROR in read file %s\n", ctrl->batch_file);
+        ret = EXIT_FAILURE;
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    if (ret != EXIT_SUCCESS) {
+        free(list);
+        return ret;
+    }
+    *ops = list;
+    *count = num;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn batch_handler
+ *
+ * @brief Run all field operations of the batch script, then report the
+ *        result of each operation prefixed by its line number.
+ * @param  ctrl [IN] - NVPARAM controller struct
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int batch_handler (nvparm_ctrl_t *ctrl)
+{
+    int ret = EXIT_SUCCESS;
+    nvp_batch_op_t *ops = NULL;
+    nvp_batch_op_t **sorted = NULL;
+    int count = 0;
+
+    ret = load_batch_script(ctrl, &ops, &count);
+    if (ret != EXIT_SUCCESS || count == 0) {
+        free(ops);
+        return ret;
+    }
+
+    sorted = (nvp_batch_op_t **)malloc(count * sizeof(*sorted));
+    if (sorted == NULL) {
+        log_printf(LOG_ERROR, "Can't allocate memory\n");
+        free(ops);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < count; i++) {
+        sorted[i] = &ops[i];
+    }
+    qsort(sorted, count, sizeof(*sorted), compare_batch_op);
+
+    ret = spinor_batch_handler(ctrl, sorted, count);
+
+    /* Report in the order of the script */
+    for (int i = 0; i < count; i++) {
+        log_printf(LOG_NORMAL, "%d: ", ops[i].line);
+        if (ops[i].status != EXIT_SUCCESS) {
+            log_printf(LOG_NORMAL, "FAILED\n");
+        } else if (ops[i].ctrl.options[OPTION_R]) {
+            print_nvp_field(&ops[i].field);
+        } else {
+            log_printf(LOG_NORMAL, "OK\n");
+        }
+    }
+
+    free(sorted);
+    free(ops);
+    return ret;
+}
\ No newline at end of file
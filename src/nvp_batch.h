@@ -0,0 +1,34 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#ifndef _NVP_BATCH_H_
+#define _NVP_BATCH_H_
+
+#include "utils.h"
+
+/* Read the batch script from stdin */
+#define BATCH_STDIN                 "-"
+#define BATCH_LINE_LEN              512
+#define BATCH_MAX_TOKENS            6
+
+/* One field operation of the batch script */
+typedef struct nvp_batch_op {
+    int line;                   // Line number in the batch script
+    nvparm_ctrl_t ctrl;         // Operation as if given on the command line
+    int status;                 // Result of the operation
+    struct nvp_field field;     // Field read by the "r" operation
+} nvp_batch_op_t;
+
+extern int batch_handler (nvparm_ctrl_t *ctrl);
+
+#endif  /* _NVP_BATCH_H_ */
\ No newline at end of file
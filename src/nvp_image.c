@@ -0,0 +1,259 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "nvp_image.h"
+
+/**
+ * @fn nvp_image_mark_dirty
+ *
+ * @brief Extend the modified range of the image
+ * @param  img [IN/OUT] - NVP image
+ * @param  offset [IN] - Offset of the modified bytes
+ * @param  size [IN] - Number of modified bytes
+ **/
+static void nvp_image_mark_dirty(nvp_image_t *img, uint32_t offset,
+                                 uint32_t size)
+{
+    if (img->dirty_end == 0 || offset < img->dirty_start) {
+        img->dirty_start = offset;
+    }
+    if (offset + size > img->dirty_end) {
+        img->dirty_end = offset + size;
+    }
+}
+
+/**
+ * @fn nvp_image_set_valid
+ *
+ * @brief Update the valid bit of a field from the -v option
+ * @param  val_bit_arr [IN/OUT] - Valid bit array of the image
+ * @param  ctrl [IN] - Input control structure
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int nvp_image_set_valid(uint8_t *val_bit_arr, nvparm_ctrl_t *ctrl)
+{
+    if (ctrl->valid_bit == NVP_FIELD_IGNORE) {
+        UINT8_CLEAR_BIT(val_bit_arr, ctrl->field_index);
+    } else if (ctrl->valid_bit == NVP_FIELD_SET) {
+        UINT8_SET_BIT(val_bit_arr, ctrl->field_index);
+    } else {
+        log_printf(LOG_ERROR, "Unsupported valid bit value: 0x%.2x\n",
+                   ctrl->valid_bit);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn nvp_image_check_header
+ *
+ * @brief Check that the NVP header describes a valid bit array and fields
+ *        inside an NVP file of the given size
+ * @param  header [IN] - NVP header at the start of the file
+ * @param  size [IN] - Size of the NVP file in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int nvp_image_check_header(const struct nvp_header *header, uint32_t size)
+{
+    uint32_t val_bit_arr_sz = 0;
+
+    if (size < sizeof(*header)) {
+        log_printf(LOG_ERROR, "NVP file smaller than its header\n");
+        return EXIT_FAILURE;
+    }
+    if (header->field_size != NVP_FIELD_SIZE_1 &&
+        header->field_size != NVP_FIELD_SIZE_4 &&
+        header->field_size != NVP_FIELD_SIZE_8) {
+        log_printf(LOG_ERROR, "Unsupported field size: %d\n",
+                   header->field_size);
+        return EXIT_FAILURE;
+    }
+    val_bit_arr_sz = header->count / NVP_VAL_BIT_PER_ELE +
+                     ((header->count % NVP_VAL_BIT_PER_ELE) ? 1 : 0);
+    if (sizeof(*header) + val_bit_arr_sz > size ||
+        header->data_offset + (uint32_t)header->count * header->field_size >
+        size) {
+        log_printf(LOG_ERROR, "NVP fields exceed the file size\n");
+        return EXIT_FAILURE;
+    }
+    if ((header->flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) &&
+        header->length > size) {
+        log_printf(LOG_ERROR, "NVP checksum length exceeds the file size\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn nvp_image_apply
+ *
+ * @brief Operate on specific NVP field and its associated valid bit of the
+ *        NVP file in memory. Nothing is written to the device.
+ * @param  img [IN/OUT] - NVP image
+ * @param  ctrl [IN] - Input control structure
+ * @param  field [OUT] - Field data and valid bit read by option -r
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int nvp_image_apply(nvp_image_t *img, nvparm_ctrl_t *ctrl,
+                    struct nvp_field *field)
+{
+    struct nvp_header *header = (struct nvp_header *)img->data;
+    uint8_t *val_bit_arr = NULL;
+    uint32_t val_bit_arr_sz = 0;
+    uint32_t offset = 0;
+    uint32_t val_idx = 0;
+    uint64_t nvp_value = 0;
+    uint8_t old_field[MAX_NVP_FIELD_SIZE] = {0};
+    uint8_t old_valid = 0;
+    uint8_t checksum = 0;
+
+    if (img->size < sizeof(*header)) {
+        log_printf(LOG_ERROR, "ERROR in read NVP header\n");
+        return EXIT_FAILURE;
+    }
+    if (ctrl->field_index >= header->count) {
+        log_printf(LOG_ERROR, "Invalid NVP field index\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Valid bit array follows the header */
+    val_bit_arr_sz = header->count / NVP_VAL_BIT_PER_ELE +
+                     ((header->count % NVP_VAL_BIT_PER_ELE) ? 1 : 0);
+    val_bit_arr = img->data + sizeof(*header);
+    if (sizeof(*header) + val_bit_arr_sz > img->size) {
+        log_printf(LOG_ERROR, "ERROR in read NVP valid bit array\n");
+        return EXIT_FAILURE;
+    }
+
+    offset = header->data_offset + ctrl->field_index * header->field_size;
+    if (header->field_size > MAX_NVP_FIELD_SIZE ||
+        offset + header->field_size > img->size) {
+        log_printf(LOG_ERROR, "ERROR in read NVP field\n");
+        return EXIT_FAILURE;
+    }
+
+    #ifdef DEBUG
+    log_printf(LOG_DEBUG, "Valid bit array value:");
+    for (uint32_t i = 0; i < val_bit_arr_sz; i++) {
+        log_printf(LOG_DEBUG, " 0x%.2x", val_bit_arr[i]);
+    }
+    log_printf(LOG_DEBUG, "\n");
+    log_printf(LOG_DEBUG, "NVP HEADER:\n");
+    log_printf(LOG_DEBUG, "field_size: %d, flags:%d, count:%d, data_offset:%d\n",
+    header->field_size, header->flags, header->count, header->data_offset);
+    #endif
+
+    if (ctrl->options[OPTION_R]) {
+        memcpy(&nvp_value, img->data + offset, header->field_size);
+        /* Get the bit of nvp field index */
+        field->valid = UINT8_GET_BIT(val_bit_arr, ctrl->field_index);
+        field->size = header->field_size;
+        field->value = nvp_value;
+        return EXIT_SUCCESS;
+    }
+
+    /* The checksum covers header->length bytes of the file */
+    if ((header->flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) &&
+        header->length > img->size) {
+        log_printf(LOG_ERROR, "ERROR in read NVP blobs\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Keep the bytes about to change for the checksum update */
+    val_idx = ctrl->field_index / NVP_VAL_BIT_PER_ELE;
+    memcpy(old_field, img->data + offset, header->field_size);
+    old_valid = val_bit_arr[val_idx];
+
+    if (ctrl->options[OPTION_W]) {
+        if (UINT64_VALIDATE_NVP(header->field_size, ctrl->nvp_data)) {
+            log_printf(LOG_ERROR,
+                       "NVP data exceeds MAX value of field size %d bytes\n",
+                       header->field_size);
+            return EXIT_FAILURE;
+        }
+        /* Update valid bit, the nvp field is set by default */
+        if (ctrl->options[OPTION_V]) {
+            if (nvp_image_set_valid(val_bit_arr, ctrl) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            UINT8_SET_BIT(val_bit_arr, ctrl->field_index);
+        }
+        memcpy(img->data + offset, &ctrl->nvp_data, header->field_size);
+    } else if (ctrl->options[OPTION_V]) {
+        if (nvp_image_set_valid(val_bit_arr, ctrl) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    } else if (ctrl->options[OPTION_E]) {
+        /* Erase NVP field by set its all data to 1 */
+        memset(img->data + offset, 0xFF, header->field_size);
+        /* Set the associated valid bit of NVP field to 0 */
+        UINT8_CLEAR_BIT(val_bit_arr, ctrl->field_index);
+    } else {
+        return EXIT_SUCCESS;
+    }
+    nvp_image_mark_dirty(img, offset, header->field_size);
+    nvp_image_mark_dirty(img, sizeof(*header), val_bit_arr_sz);
+
+    #ifdef DEBUG
+    log_printf(LOG_DEBUG, "Valid bit array value after update:");
+    for (uint32_t i = 0; i < val_bit_arr_sz; i++) {
+        log_printf(LOG_DEBUG, " 0x%.2x", val_bit_arr[i]);
+    }
+    log_printf(LOG_DEBUG, "\n");
+    #endif
+
+    if (header->flags & NVPARAM_HEADER_FLAGS_CHECKSUM_VALID) {
+        /* Only the field and one byte of the valid bit array changed */
+        checksum = update_sum8(header->checksum, old_field,
+                               img->data + offset, offset,
+                               header->field_size, header->length);
+        checksum = update_sum8(checksum, &old_valid, &val_bit_arr[val_idx],
+                               sizeof(*header) + val_idx, 1, header->length);
+        if (ctrl->options[OPTION_VERIFY_CS]) {
+            /* Clear current checksum */
+            header->checksum = 0;
+            header->checksum = calculate_sum8(img->data, header->length);
+            if (header->checksum != checksum) {
+                log_printf(LOG_ERROR, "WARN: Checksum update 0x%x mismatches "
+                           "full checksum 0x%x, use full checksum\n",
+                           checksum, header->checksum);
+            }
+        } else {
+            header->checksum = checksum;
+        }
+        log_printf(LOG_DEBUG, "New checksum: 0x%x\n", header->checksum);
+        nvp_image_mark_dirty(img, 0, sizeof(*header));
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn nvp_image_free
+ *
+ * @brief Release the memory of the NVP image
+ * @param  img [IN/OUT] - NVP image
+ **/
+void nvp_image_free(nvp_image_t *img)
+{
+    free(img->data);
+    memset(img, 0, sizeof(*img));
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#ifndef _NVP_IMAGE_H_
+#define _NVP_IMAGE_H_
+
+#include "utils.h"
+
+/* NVP file loaded in memory to apply field operations before write back */
+typedef struct nvp_image {
+    uint8_t *data;          // Content of the whole NVP file
+    uint32_t size;          // Size of the NVP file in byte
+    uint32_t dirty_start;   // First byte modified in memory
+    uint32_t dirty_end;     // End of the modified bytes, 0 if unmodified
+} nvp_image_t;
+
+extern int nvp_image_apply(nvp_image_t *img, nvparm_ctrl_t *ctrl,
+                           struct nvp_field *field);
+extern int nvp_image_check_header(const struct nvp_header *header,
+                                  uint32_t size);
+extern void nvp_image_free(nvp_image_t *img);
+
+#endif  /* _NVP_IMAGE_H_ */
\ No newline at end of file
@@ -34,10 +34,30 @@
 #include "utils.h"
 #include "bsd_eeprom_nvp.h"
 #include "hostfw_nvp.h"
+#include "nvp_batch.h"
+#include "nvparmd.h"
 
 /* Option string of this application */
 #define OPTION_STRING   "t:u:f:i:rew:v:d:b:s:o:D:phV"
 
+/* Long options without a short option equivalent */
+#define LONG_OPT_BATCH  0x100
+#define LONG_OPT_DAEMON 0x101
+#define LONG_OPT_VERIFY_CS 0x102
+#define LONG_OPT_CHUNK_SIZE 0x103
+#define LONG_OPT_DIFF   0x104
+#define LONG_OPT_EEPROM_PAGE 0x105
+
+static const struct option long_options[] = {
+    {"batch", required_argument, NULL, LONG_OPT_BATCH},
+    {"daemon", no_argument, NULL, LONG_OPT_DAEMON},
+    {"verify-checksum", no_argument, NULL, LONG_OPT_VERIFY_CS},
+    {"chunk-size", required_argument, NULL, LONG_OPT_CHUNK_SIZE},
+    {"diff", no_argument, NULL, LONG_OPT_DIFF},
+    {"eeprom-page-size", required_argument, NULL, LONG_OPT_EEPROM_PAGE},
+    {NULL, 0, NULL, 0}
+};
+
 static nvparm_ctrl_t nvparm_ctrl = { 0 };
 
 /**
@@ -65,13 +85,25 @@ static void help (void)
         "  -v <valid_bit>   : Enable or disable valid bit.\n"
         "  -w <nvp_data>    : Write data to a field and its associated valid bit.\n"
         "  -e               : Erase field at field_index.\n"
-        "  -d <raw_file>    : Dump specific NVP file into raw file.\n"
+        "  -d <raw_file>    : Dump specific NVP file into raw file ('-' for stdout).\n"
         "  -o <new_nvp_file>: New NVP file.\n"
         "  -b <i2c_bus>     : The I2C bus number. Default is 10 (I2C11).\n"
         "  -s <target_addr>  : The target address of the EEPROM. Default is 0x50.\n"
         "  -p               : Print GPT header. NVP partition names and GUIDs will be displayed.\n"
         "  -V               : Show version information.\n"
         "  -D <device>      : The MTD partition path\n"
+        "  --batch <script> : Run the field operations listed in script ('-' for stdin).\n"
+        "                     Each line: <nvp_part|nvp_guid> <nvp_file> <field_index> <op> [args]\n"
+        "                     with op: r | w <nvp_data> [<valid_bit>] | v <valid_bit> | e\n"
+        "  --daemon         : Run as daemon keeping the SPI-NOR device and partitions mounted.\n"
+        "                     Other nvparm calls on the same device are served by the daemon.\n"
+        "  --verify-checksum: Recalculate the NVP checksum over the whole file after a change\n"
+        "                     and check it against the incremental update.\n"
+        "  --chunk-size <n> : Read size of -d on the SPI-NOR, up to and by default the\n"
+        "                     erase block size.\n"
+        "  --diff           : With -o on the SPI-NOR, only write the bytes that changed and\n"
+        "                     report the bytes programmed.\n"
+        "  --eeprom-page-size <n>: Page size of the EEPROM: 256 (default), 128, 32 or 8.\n"
         "  -h               : Print this help.\n"
     );
 }
@@ -100,6 +132,7 @@ static int parse_opt (int argc, char** argv)
     char *input_target = NULL;
     char *endptr = NULL; // Store the location where conversion stopped
     char *device_name= NULL;
+    char *batch_file = NULL;
 
     unsigned long input = ULONG_MAX;
     unsigned long long input_ll = ULLONG_MAX;
@@ -110,7 +143,8 @@ static int parse_opt (int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    while ((argflag = getopt(argc, (char **)argv, OPTION_STRING)) != -1) {
+    while ((argflag = getopt_long(argc, (char **)argv, OPTION_STRING,
+                                  long_options, NULL)) != -1) {
         switch (argflag) {
         case 't':
             nvparm_ctrl.options[OPTION_T] = 1;
@@ -410,6 +444,68 @@ static int parse_opt (int argc, char** argv)
                         sizeof(nvparm_ctrl.device_name));
             }
             break;
+        case LONG_OPT_DAEMON:
+            nvparm_ctrl.options[OPTION_DAEMON] = 1;
+            break;
+        case LONG_OPT_VERIFY_CS:
+            nvparm_ctrl.options[OPTION_VERIFY_CS] = 1;
+            break;
+        case LONG_OPT_CHUNK_SIZE:
+            nvparm_ctrl.options[OPTION_CHUNK_SIZE] = 1;
+            errno = 0;
+            input = strtoul(optarg, &endptr, 0);
+            if (errno != 0 || *endptr != '\0' || input == 0 ||
+                input > UINT32_MAX) {
+                log_printf(LOG_ERROR, "Invalid chunk size: %s\n", optarg);
+                ret = EXIT_FAILURE;
+            } else {
+                nvparm_ctrl.chunk_size = (uint32_t)input;
+            }
+            break;
+        case LONG_OPT_EEPROM_PAGE:
+            nvparm_ctrl.options[OPTION_EEPROM_TYPE] = 1;
+            errno = 0;
+            input = strtoul(optarg, &endptr, 0);
+            if (errno != 0 || *endptr != '\0') {
+                input = 0;
+            }
+            if (input == EEPROM_256B_PAGE_SIZE) {
+                nvparm_ctrl.eeprom_type = EEPROM_256B;
+            } else if (input == EEPROM_128B_PAGE_SIZE) {
+                nvparm_ctrl.eeprom_type = EEPROM_128B;
+            } else if (input == EEPROM_32B_PAGE_SIZE) {
+                nvparm_ctrl.eeprom_type = EEPROM_32B;
+            } else if (input == EEPROM_8B_PAGE_SIZE) {
+                nvparm_ctrl.eeprom_type = EEPROM_8B;
+            } else {
+                log_printf(LOG_ERROR, "Unsupported EEPROM page size: %s\n",
+                           optarg);
+                ret = EXIT_FAILURE;
+            }
+            break;
+        case LONG_OPT_DIFF:
+            nvparm_ctrl.options[OPTION_DIFF] = 1;
+            break;
+        case LONG_OPT_BATCH:
+            nvparm_ctrl.options[OPTION_BATCH] = 1;
+            if (batch_file != NULL) {
+                free(batch_file);
+                batch_file = NULL;
+            }
+            batch_file = strdup(optarg);
+            if (batch_file == NULL) {
+                log_printf(LOG_ERROR, "Option --batch: malloc failure\n");
+                ret = EXIT_FAILURE;
+            } else if (strlen(batch_file) >= MAX_NAME_LENGTH) {
+                log_printf(LOG_ERROR, "batch file name is too long."
+                                      " Allow less than %d characters\n",
+                                      MAX_NAME_LENGTH);
+                ret = EXIT_FAILURE;
+            } else {
+                strncpy((char *)nvparm_ctrl.batch_file, batch_file,
+                        sizeof(nvparm_ctrl.batch_file));
+            }
+            break;
         default:
             help();
             break;
@@ -460,6 +556,10 @@ static int parse_opt (int argc, char** argv)
         free(device_name);
         device_name= NULL;
     }
+    if (batch_file) {
+        free(batch_file);
+        batch_file = NULL;
+    }
     return ret;
 }
 
@@ -475,6 +575,50 @@ static int verify_opt (void)
     int ret = EXIT_SUCCESS;
     nvparm_ctrl_t *ctrl = &nvparm_ctrl;
 
+    if (ctrl->options[OPTION_BATCH] || ctrl->options[OPTION_DAEMON]) {
+        /* Partitions, files and operations come from the script or clients */
+        for (int i = 0; i < MAX_OPTIONS; i++) {
+            if (ctrl->options[i] && i != OPTION_BATCH &&
+                i != OPTION_DAEMON && i != OPTION_DEV &&
+                !(i == OPTION_VERIFY_CS && ctrl->options[OPTION_BATCH])) {
+                ret = EXIT_FAILURE;
+                break;
+            }
+        }
+        if (ctrl->options[OPTION_BATCH] && ctrl->options[OPTION_DAEMON]) {
+            ret = EXIT_FAILURE;
+        }
+        if (ret != EXIT_SUCCESS) {
+            log_printf(LOG_ERROR,
+                       "Option --batch or --daemon can only be mixed with -D"
+                       " (and --verify-checksum for --batch).\n");
+        }
+        goto exit_verify;
+    }
+
+    if (ctrl->options[OPTION_CHUNK_SIZE] &&
+        !(ctrl->device == SPINOR && ctrl->options[OPTION_D])) {
+        ret = EXIT_FAILURE;
+        log_printf(LOG_ERROR,
+                   "Option --chunk-size is only used with -d on the SPI-NOR.\n");
+        goto exit_verify;
+    }
+
+    if (ctrl->options[OPTION_DIFF] &&
+        !(ctrl->device == SPINOR && ctrl->options[OPTION_O])) {
+        ret = EXIT_FAILURE;
+        log_printf(LOG_ERROR,
+                   "Option --diff is only used with -o on the SPI-NOR.\n");
+        goto exit_verify;
+    }
+
+    if (ctrl->options[OPTION_EEPROM_TYPE] && ctrl->device != EEPROM) {
+        ret = EXIT_FAILURE;
+        log_printf(LOG_ERROR,
+                   "Option --eeprom-page-size is only used with the EEPROM.\n");
+        goto exit_verify;
+    }
+
     if (ctrl->options[OPTION_P] || ctrl->options[OPTION_H] ||
         ctrl->options[OPTION_VER]) {
         if (ctrl->options[OPTION_T] || ctrl->options[OPTION_U] ||
@@ -624,8 +768,15 @@ int main (int argc, char **argv)
                            NVPARM_VERSION_PATCH);
             } else if (nvparm_ctrl.options[OPTION_H]) {
                 help();
+            } else if (nvparm_ctrl.options[OPTION_BATCH]) {
+                ret = batch_handler(&nvparm_ctrl);
+            } else if (nvparm_ctrl.options[OPTION_DAEMON]) {
+                ret = nvparmd_server(&nvparm_ctrl);
             } else if (nvparm_ctrl.device == SPINOR) {
-                ret = spinor_handler(&nvparm_ctrl);
+                /* Use the daemon when it is running */
+                if (nvparmd_client_handler(&nvparm_ctrl, &ret) != EXIT_SUCCESS) {
+                    ret = spinor_handler(&nvparm_ctrl);
+                }
             } else {
                 ret = bsd_eeprom_handler(&nvparm_ctrl);
             }
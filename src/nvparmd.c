@@ -0,0 +1,491 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * The nvparm daemon keeps the host SPI NOR device open and its GPT parsed,
+ * then serves field and dump requests of the nvparm CLI over a Unix domain
+ * socket. Requests are served one at a time. Each request locks the device
+ * and mounts its partition, which is unmounted before the device is
+ * unlocked: nvparm and the host firmware may write it between requests.
+ **/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nvparmd.h"
+#include "hostfw_nvp.h"
+
+static volatile sig_atomic_t nvparmd_stop = 0;
+static volatile sig_atomic_t nvparmd_reload = 0;
+
+/**
+ * @fn nvparmd_signal
+ *
+ * @brief Signal handler: SIGHUP rescans the device, others stop the daemon.
+ * @param  sig [IN] - The received signal
+ **/
+static void nvparmd_signal(int sig)
+{
+    if (sig == SIGHUP) {
+        nvparmd_reload = 1;
+    } else {
+        nvparmd_stop = 1;
+    }
+}
+
+/**
+ * @fn send_all
+ *
+ * @brief Send the whole buffer to the socket.
+ * @param  fd [IN] - Connected socket
+ * @param  buf [IN] - Data to send
+ * @param  len [IN] - Size of data in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    ssize_t sz = 0;
+
+    while (len > 0) {
+        sz = write(fd, p, len);
+        if (sz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sz <= 0) {
+            return EXIT_FAILURE;
+        }
+        p += sz;
+        len -= sz;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn recv_all
+ *
+ * @brief Receive exactly len bytes from the socket.
+ * @param  fd [IN] - Connected socket
+ * @param  buf [OUT] - Received data
+ * @param  len [IN] - Size of data in byte
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int recv_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+    ssize_t sz = 0;
+
+    while (len > 0) {
+        sz = read(fd, p, len);
+        if (sz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sz <= 0) {
+            return EXIT_FAILURE;
+        }
+        p += sz;
+        len -= sz;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn nvparmd_socket_addr
+ *
+ * @brief Fill the address of the daemon socket.
+ * @param  addr [OUT] - Socket address
+ **/
+static void nvparmd_socket_addr(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, NVPARMD_SOCKET_PATH, sizeof(addr->sun_path) - 1);
+}
+
+/**
+ * @fn request_to_ctrl
+ *
+ * @brief Convert a daemon request to the nvparam controller structure.
+ * @param  req [IN] - Received request
+ * @param  ctrl [OUT] - Equivalent command line options
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+static int request_to_ctrl(struct nvparmd_request *req, nvparm_ctrl_t *ctrl)
+{
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->device = SPINOR;
+
+    /* Never trust the strings to be terminated */
+    req->nvp_part[sizeof(req->nvp_part) - 1] = '\0';
+    req->nvp_file[sizeof(req->nvp_file) - 1] = '\0';
+
+    if (req->use_guid) {
+        ctrl->options[OPTION_U] = 1;
+        memcpy(ctrl->nvp_guid, req->nvp_guid, GUID_BYTE_SIZE);
+    } else {
+        ctrl->options[OPTION_T] = 1;
+        strncpy(ctrl->nvp_part, req->nvp_part, sizeof(ctrl->nvp_part));
+    }
+    ctrl->options[OPTION_F] = 1;
+    strncpy(ctrl->nvp_file, req->nvp_file, sizeof(ctrl->nvp_file));
+    ctrl->options[OPTION_I] = 1;
+    ctrl->field_index = req->field_index;
+    ctrl->options[OPTION_VERIFY_CS] = req->verify_cs ? 1 : 0;
+
+    switch (req->op) {
+    case NVPARMD_OP_READ:
+        ctrl->options[OPTION_R] = 1;
+        break;
+    case NVPARMD_OP_WRITE:
+        ctrl->options[OPTION_W] = 1;
+        ctrl->nvp_data = req->nvp_data;
+        ctrl->options[OPTION_V] = req->set_valid ? 1 : 0;
+        ctrl->valid_bit = req->valid_bit;
+        break;
+    case NVPARMD_OP_VALID:
+        ctrl->options[OPTION_V] = 1;
+        ctrl->valid_bit = req->valid_bit;
+        break;
+    case NVPARMD_OP_ERASE:
+        ctrl->options[OPTION_E] = 1;
+        break;
+    case NVPARMD_OP_DUMP:
+        ctrl->options[OPTION_D] = 1;
+        break;
+    default:
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @fn ctrl_to_request
+ *
+ * @brief Convert the nvparam controller structure to a daemon request.
+ * @param  ctrl [IN] - Command line options
+ * @param  req [OUT] - Request to send
+ * @return  0 - Success
+ *          1 - The operation is not served by the daemon
+ **/
+static int ctrl_to_request(nvparm_ctrl_t *ctrl, struct nvparmd_request *req)
+{
+    memset(req, 0, sizeof(*req));
+    req->magic = NVPARMD_MAGIC;
+    req->version = NVPARMD_PROTO_VERSION;
+
+    if (ctrl->device != SPINOR) {
+        return EXIT_FAILURE;
+    }
+    if (ctrl->options[OPTION_R]) {
+        req->op = NVPARMD_OP_READ;
+    } else if (ctrl->options[OPTION_W]) {
+        req->op = NVPARMD_OP_WRITE;
+        req->nvp_data = ctrl->nvp_data;
+        req->set_valid = ctrl->options[OPTION_V];
+        req->valid_bit = ctrl->valid_bit;
+    } else if (ctrl->options[OPTION_V]) {
+        req->op = NVPARMD_OP_VALID;
+        req->valid_bit = ctrl->valid_bit;
+    } else if (ctrl->options[OPTION_E]) {
+        req->op = NVPARMD_OP_ERASE;
+    } else if (ctrl->options[OPTION_D]) {
+        req->op = NVPARMD_OP_DUMP;
+    } else {
+        return EXIT_FAILURE;
+    }
+
+    req->use_guid = ctrl->options[OPTION_U];
+    memcpy(req->nvp_guid, ctrl->nvp_guid, GUID_BYTE_SIZE);
+    strncpy(req->nvp_part, ctrl->nvp_part, sizeof(req->nvp_part) - 1);
+    strncpy(req->nvp_file, ctrl->nvp_file, sizeof(req->nvp_file) - 1);
+    req->field_index = ctrl->field_index;
+    req->verify_cs = ctrl->options[OPTION_VERIFY_CS];
+    /* The daemon compares the device itself, not how it was named */
+    return find_host_mtd_device(ctrl, req->device_name,
+                                sizeof(req->device_name));
+}
+
+/**
+ * @fn nvparmd_same_device
+ *
+ * @brief Check if a device path names the device opened by the daemon
+ * @param  path [IN] - Device path of the request
+ * @param  fd [IN] - Device file descriptor of the daemon
+ * @return  1 - Same device
+ *          0 - Other device
+ **/
+static int nvparmd_same_device(const char *path, int fd)
+{
+    struct stat req_st, dev_st;
+
+    if (stat(path, &req_st) < 0 || fstat(fd, &dev_st) < 0) {
+        return 0;
+    }
+    /* Device nodes of one MTD device may have several paths */
+    if (S_ISCHR(req_st.st_mode) && S_ISCHR(dev_st.st_mode)) {
+        return req_st.st_rdev == dev_st.st_rdev;
+    }
+    return req_st.st_dev == dev_st.st_dev && req_st.st_ino == dev_st.st_ino;
+}
+
+/**
+ * @fn nvparmd_serve
+ *
+ * @brief Serve one request of a connected client.
+ * @param  conn [IN] - Connected socket
+ * @param  sess [IN/OUT] - The SPI NOR session kept by the daemon
+ **/
+static void nvparmd_serve(int conn, spinor_session_t *sess)
+{
+    struct nvparmd_request req;
+    struct nvparmd_response resp;
+    nvparm_ctrl_t ctrl;
+    struct nvp_field field = {0};
+    uint8_t *data = NULL;
+    uint32_t len = 0;
+
+    memset(&resp, 0, sizeof(resp));
+    resp.magic = NVPARMD_MAGIC;
+
+    if (recv_all(conn, &req, sizeof(req)) != EXIT_SUCCESS) {
+        return;
+    }
+    req.device_name[sizeof(req.device_name) - 1] = '\0';
+
+    if (req.magic != NVPARMD_MAGIC || req.version != NVPARMD_PROTO_VERSION ||
+        request_to_ctrl(&req, &ctrl) != EXIT_SUCCESS) {
+        resp.status = NVPARMD_ST_BAD_REQUEST;
+    } else if (!nvparmd_same_device(req.device_name, sess->dev_fd)) {
+        resp.status = NVPARMD_ST_OTHER_DEVICE;
+    } else if (spinor_session_lock(sess) != EXIT_SUCCESS) {
+        resp.status = NVPARMD_ST_FAIL;
+    } else {
+        if (spinor_session_mount(sess, &ctrl) != EXIT_SUCCESS) {
+            resp.status = NVPARMD_ST_FAIL;
+        } else if (ctrl.options[OPTION_D]) {
+            if (spinor_load_nvp(ctrl.nvp_file, &data, &len) != EXIT_SUCCESS) {
+                resp.status = NVPARMD_ST_FAIL;
+            } else {
+                resp.data_len = len;
+            }
+        } else if (spinor_field_hdlr(&ctrl, &field) != EXIT_SUCCESS) {
+            resp.status = NVPARMD_ST_FAIL;
+        } else {
+            resp.valid = field.valid;
+            resp.field_size = field.size;
+            resp.value = field.value;
+        }
+        /* The response is sent once the device is free again */
+        spinor_session_unlock(sess);
+    }
+
+    if (send_all(conn, &resp, sizeof(resp)) == EXIT_SUCCESS &&
+        resp.data_len > 0) {
+        send_all(conn, data, resp.data_len);
+    }
+    free(data);
+}
+
+/**
+ * @fn nvparmd_server
+ *
+ * @brief Run the nvparm daemon until SIGTERM or SIGINT.
+ * @param  ctrl [IN] - NVPARAM controller struct (device selection)
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int nvparmd_server (nvparm_ctrl_t *ctrl)
+{
+    int ret = EXIT_SUCCESS;
+    int sock = -1, conn = -1;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    spinor_session_t sess;
+
+    ret = spinor_session_open(ctrl, &sess);
+    if (ret != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    /* The device is only locked while a request is served */
+    spinor_session_unlock(&sess);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        log_printf(LOG_ERROR, "Cannot create socket: %s\n", strerror(errno));
+        ret = EXIT_FAILURE;
+        goto out_sess;
+    }
+    nvparmd_socket_addr(&addr);
+    /* Remove the socket left by a previous instance */
+    unlink(addr.sun_path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(addr.sun_path, S_IRUSR | S_IWUSR) < 0 ||
+        listen(sock, NVPARMD_BACKLOG) < 0) {
+        log_printf(LOG_ERROR, "Cannot listen on %s: %s\n",
+                   addr.sun_path, strerror(errno));
+        ret = EXIT_FAILURE;
+        goto out_sock;
+    }
+
+    /* No SA_RESTART so that accept() returns on signals */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = nvparmd_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    log_printf(LOG_NORMAL, "nvparmd listening on %s\n", addr.sun_path);
+    while (!nvparmd_stop) {
+        if (nvparmd_reload) {
+            /* The flash may have been updated: rescan the GPT */
+            nvparmd_reload = 0;
+            spinor_session_close(&sess);
+            if (spinor_session_open(ctrl, &sess) != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+                break;
+            }
+            spinor_session_unlock(&sess);
+        }
+        conn = accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_printf(LOG_ERROR, "accept failed: %s\n", strerror(errno));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        nvparmd_serve(conn, &sess);
+        close(conn);
+    }
+    unlink(addr.sun_path);
+
+out_sock:
+    close(sock);
+out_sess:
+    spinor_session_close(&sess);
+    return ret;
+}
+
+/**
+ * @fn nvparmd_client_handler
+ *
+ * @brief Forward the operation to the nvparm daemon when it is running.
+ * @param  ctrl [IN] - NVPARAM controller struct
+ * @param  result [OUT] - Result of the operation served by the daemon
+ * @return  0 - The operation was served by the daemon
+ *          1 - No daemon to serve it, the caller must run it locally
+ **/
+int nvparmd_client_handler (nvparm_ctrl_t *ctrl, int *result)
+{
+    int ret = EXIT_FAILURE;
+    int sock = -1;
+    struct sockaddr_un addr;
+    struct nvparmd_request req;
+    struct nvparmd_response resp;
+    struct nvp_field field = {0};
+    uint8_t buff[DEFAULT_PAGE_SIZE];
+    uint32_t remain = 0, bytes = 0;
+    FILE *fp = NULL;
+
+    if (ctrl_to_request(ctrl, &req) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return EXIT_FAILURE;
+    }
+    nvparmd_socket_addr(&addr);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_printf(LOG_DEBUG, "nvparmd not running: %s\n", strerror(errno));
+        close(sock);
+        return EXIT_FAILURE;
+    }
+
+    /* The daemon only runs a request received in full */
+    if (send_all(sock, &req, sizeof(req)) != EXIT_SUCCESS) {
+        log_printf(LOG_DEBUG, "nvparmd did not take the request\n");
+        goto out;
+    }
+    /*
+     * The request may have been executed, so it must not run again
+     * locally.
+     */
+    if (recv_all(sock, &resp, sizeof(resp)) != EXIT_SUCCESS ||
+        resp.magic != NVPARMD_MAGIC) {
+        log_printf(LOG_ERROR, "nvparmd did not answer, the request may "
+                   "have been executed\n");
+        ret = EXIT_SUCCESS;
+        *result = EXIT_FAILURE;
+        goto out;
+    }
+    if (resp.status == NVPARMD_ST_BAD_REQUEST ||
+        resp.status == NVPARMD_ST_OTHER_DEVICE) {
+        log_printf(LOG_DEBUG, "nvparmd refused request: %d\n", resp.status);
+        goto out;
+    }
+
+    /* From here the request was executed by the daemon */
+    ret = EXIT_SUCCESS;
+    *result = EXIT_SUCCESS;
+    if (resp.status != NVPARMD_ST_OK) {
+        log_printf(LOG_ERROR, "ERROR reported by nvparmd\n");
+        *result = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (ctrl->options[OPTION_R]) {
+        field.valid = resp.valid;
+        field.size = resp.field_size;
+        field.value = resp.value;
+        print_nvp_field(&field);
+    } else if (ctrl->options[OPTION_D]) {
+        fp = dump_file_open(ctrl->dump_file);
+        if (fp == NULL) {
+            log_printf(LOG_ERROR, "Cannot open file %s\n", ctrl->dump_file);
+            *result = EXIT_FAILURE;
+            goto out;
+        }
+        for (remain = resp.data_len; remain > 0; remain -= bytes) {
+            bytes = remain < sizeof(buff) ? remain : sizeof(buff);
+            if (recv_all(sock, buff, bytes) != EXIT_SUCCESS ||
+                fwrite(buff, 1, bytes, fp) != bytes) {
+                log_printf(LOG_ERROR, "ERROR in write to file %s\n",
+                           ctrl->dump_file);
+                *result = EXIT_FAILURE;
+                break;
+            }
+        }
+        if (dump_file_close(fp) != EXIT_SUCCESS) {
+            log_printf(LOG_ERROR, "ERROR in write to file %s\n",
+                       ctrl->dump_file);
+            *result = EXIT_FAILURE;
+        }
+    }
+
+out:
+    close(sock);
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+/**
+ *
+ * Copyright (c) 2023, Ampere Computing LLC
+ *
+ * This program and the accompanying materials are licensed and made available under the terms
+ * and conditions of the BSD-3-Clause License which accompanies this distribution. The full text of the
+ * license may be found within the LICENSE file at the root of this distribution or online at
+ * https://opensource.org/license/bsd-3-clause/
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ **/
+
+#ifndef _NVPARMD_H_
+#define _NVPARMD_H_
+
+#include "utils.h"
+
+/* Unix domain socket served by the nvparm daemon */
+#ifndef NVPARMD_SOCKET_PATH
+#define NVPARMD_SOCKET_PATH             "/run/nvparmd.sock"
+#endif
+#define NVPARMD_BACKLOG                 8
+
+/* "NVPD" */
+#define NVPARMD_MAGIC                   0x4450564EU
+#define NVPARMD_PROTO_VERSION           2
+
+enum nvparmd_op {
+    NVPARMD_OP_READ = 1,
+    NVPARMD_OP_WRITE,
+    NVPARMD_OP_VALID,
+    NVPARMD_OP_ERASE,
+    NVPARMD_OP_DUMP,
+};
+
+enum nvparmd_status {
+    NVPARMD_ST_OK = 0,
+    NVPARMD_ST_FAIL,            // The operation failed on the flash
+    NVPARMD_ST_BAD_REQUEST,     // Malformed request or protocol mismatch
+    NVPARMD_ST_OTHER_DEVICE,    // Request for a device not served
+};
+
+/* Request sent by the nvparm CLI, one per connection */
+struct nvparmd_request {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t op;                            // enum nvparmd_op
+    uint8_t use_guid;                       // Partition selected by GUID
+    uint8_t set_valid;                      // Valid bit given with write
+    uint8_t valid_bit;
+    uint8_t verify_cs;                      // Option --verify-checksum
+    uint16_t field_index;
+    uint64_t nvp_data;
+    uint8_t nvp_guid[GUID_BYTE_SIZE];
+    char nvp_part[MAX_PART_NAME_LEN];
+    char nvp_file[MAX_NAME_LENGTH];
+    char device_name[MAX_NAME_LENGTH];      // Path of the MTD device
+} __attribute__((packed));
+
+/* Response of the daemon, followed by data_len bytes of the dumped file */
+struct nvparmd_response {
+    uint32_t magic;
+    uint32_t status;                        // enum nvparmd_status
+    uint8_t valid;
+    uint8_t field_size;
+    uint16_t reserved;
+    uint64_t value;
+    uint32_t data_len;
+} __attribute__((packed));
+
+extern int nvparmd_server (nvparm_ctrl_t *ctrl);
+extern int nvparmd_client_handler (nvparm_ctrl_t *ctrl, int *result);
+
+#endif  /* _NVPARMD_H_ */
\ No newline at end of file
@@ -165,11 +165,11 @@ int guid_str2int (char *guid_str, uint8_t *guid_int)
  * @param  length [IN] - Data size
  * @return  checksum
  **/
-uint8_t calculate_sum8(const uint8_t *data, uint8_t length)
+uint8_t calculate_sum8(const uint8_t *data, uint32_t length)
 {
     uint8_t ret = 0;
 
-    for (uint8_t i = 0; i < length; i++) {
+    for (uint32_t i = 0; i < length; i++) {
         ret = (uint8_t)(ret + data[i]);
     }
     ret = (uint8_t)(0x100 - ret);
@@ -177,4 +177,82 @@ uint8_t calculate_sum8(const uint8_t *data, uint8_t length)
     log_printf(LOG_DEBUG, "Checksum ret: 0x%x\n", ret);
 
     return (ret);
+}
+
+/**
+ * @fn update_sum8
+ *
+ * @brief Update a checksum calculated by calculate_sum8 after some bytes of
+ *        the data changed, without reading the whole data again.
+ *        Only the changed bytes below cs_length are covered by the checksum.
+ * @param  checksum [IN] - Checksum of the data before the change
+ * @param  old_data [IN] - Changed bytes before the change
+ * @param  new_data [IN] - Changed bytes after the change
+ * @param  offset [IN] - Offset of the changed bytes in the data
+ * @param  length [IN] - Number of changed bytes
+ * @param  cs_length [IN] - Number of bytes covered by the checksum
+ * @return  checksum of the data after the change
+ **/
+uint8_t update_sum8(uint8_t checksum, const uint8_t *old_data,
+                    const uint8_t *new_data, uint32_t offset,
+                    uint32_t length, uint32_t cs_length)
+{
+    for (uint32_t i = 0; i < length && offset + i < cs_length; i++) {
+        checksum = (uint8_t)(checksum + old_data[i] - new_data[i]);
+    }
+    return checksum;
+}
+
+/**
+ * @fn print_nvp_field
+ *
+ * @brief Print the valid bit and data of an NVP field.
+ * @param  field [IN] - Field read from the NVP file
+ **/
+void print_nvp_field(const struct nvp_field *field)
+{
+    if (field->size == NVP_FIELD_SIZE_1) {
+        log_printf(LOG_NORMAL, "0x%.2x 0x%.2x\n",
+                   field->valid, (uint8_t)field->value);
+    } else if (field->size == NVP_FIELD_SIZE_4) {
+        log_printf(LOG_NORMAL, "0x%.2x 0x%.8x\n",
+                   field->valid, (uint32_t)field->value);
+    } else if (field->size == NVP_FIELD_SIZE_8) {
+        log_printf(LOG_NORMAL, "0x%.2x 0x%.16llx\n",
+                   field->valid, field->value);
+    } else {
+        log_printf(LOG_ERROR, "Unsupported field size: %d\n", field->size);
+    }
+}
+
+/**
+ * @fn dump_file_open
+ *
+ * @brief Open the target file of a dump, "-" is the standard output.
+ * @param  dump_file [IN] - Target file name
+ * @return  The opened stream, or NULL on failure
+ **/
+FILE *dump_file_open(const char *dump_file)
+{
+    if (strcmp(dump_file, DUMP_FILE_STDOUT) == 0) {
+        return stdout;
+    }
+    return fopen(dump_file, "w");
+}
+
+/**
+ * @fn dump_file_close
+ *
+ * @brief Close the target file of a dump, the standard output is flushed
+ *        only.
+ * @param  fp [IN] - Stream returned by dump_file_open()
+ * @return  0 - Success
+ *          1 - Failure
+ **/
+int dump_file_close(FILE *fp)
+{
+    if (fp == stdout) {
+        return fflush(fp) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    return fclose(fp) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
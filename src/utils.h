@@ -14,6 +14,7 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include <stdio.h>
 #include <stdint.h>
 #include <limits.h>
 
@@ -39,6 +40,9 @@
 #define MAX_PART_NAME_LEN                   72
 #define MAX_CMD_LEN                         100
 
+/* Dump file name writing to the standard output */
+#define DUMP_FILE_STDOUT                    "-"
+
 #define PERCENTAGE(x, total)                (((x) * 100) / (total))
 #define KB(x)                               ((x) / 1024)
 
@@ -83,6 +87,12 @@ enum {
     OPTION_VER,
     OPTION_O,
     OPTION_DEV,
+    OPTION_BATCH,
+    OPTION_DAEMON,
+    OPTION_VERIFY_CS,
+    OPTION_CHUNK_SIZE,
+    OPTION_DIFF,
+    OPTION_EEPROM_TYPE,
     MAX_OPTIONS
 };
 
@@ -137,11 +147,27 @@ typedef struct nvparm_ctrl {
     char upload_file[MAX_NAME_LENGTH];
     uint8_t i2c_bus;
     uint8_t target_addr;
+    uint8_t eeprom_type;
+    char batch_file[MAX_NAME_LENGTH];
+    uint32_t chunk_size;
 } nvparm_ctrl_t;
 
+/* Field content returned by a read operation */
+struct nvp_field {
+    uint8_t valid;
+    uint8_t size;
+    uint64_t value;
+};
+
 extern void log_printf (int level, const char *fmt, ...);
 extern void print_guid(uint8_t guid[16]);
 extern int guid_str2int (char *guid_str, uint8_t *guid_int);
-extern uint8_t calculate_sum8(const uint8_t *data, uint8_t length);
+extern uint8_t calculate_sum8(const uint8_t *data, uint32_t length);
+extern uint8_t update_sum8(uint8_t checksum, const uint8_t *old_data,
+                           const uint8_t *new_data, uint32_t offset,
+                           uint32_t length, uint32_t cs_length);
+extern void print_nvp_field(const struct nvp_field *field);
+extern FILE *dump_file_open(const char *dump_file);
+extern int dump_file_close(FILE *fp);
 
 #endif /* _UTILS_H_ */
\ No newline at end of file